@@ -0,0 +1,81 @@
+#include "audio_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool audio_ring_init(audio_ring *ring, size_t min_capacity) {
+  size_t capacity = 1;
+  while (capacity < min_capacity)
+    capacity <<= 1;
+
+  ring->data = calloc(capacity, sizeof(float));
+  if (!ring->data)
+    return false;
+
+  ring->capacity = capacity;
+  ring->mask = capacity - 1;
+  atomic_init(&ring->write_pos, 0);
+  atomic_init(&ring->read_pos, 0);
+  return true;
+}
+
+void audio_ring_free(audio_ring *ring) {
+  free(ring->data);
+  ring->data = NULL;
+  ring->capacity = 0;
+  ring->mask = 0;
+}
+
+size_t audio_ring_write(audio_ring *ring, const float *samples, size_t count) {
+  // Only the producer stores write_pos, so a relaxed load sees its own value
+  size_t write_pos =
+      atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+  // Acquire pairs with the consumer's release so its reads of the space we
+  // are about to reuse have finished
+  size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_acquire);
+
+  size_t space = ring->capacity - (write_pos - read_pos);
+  if (count > space)
+    count = space;
+  if (count == 0)
+    return 0;
+
+  // At most two segments: up to the end of the buffer, then from the start
+  size_t start = write_pos & ring->mask;
+  size_t first = ring->capacity - start;
+  if (first > count)
+    first = count;
+  memcpy(ring->data + start, samples, first * sizeof(float));
+  memcpy(ring->data, samples + first, (count - first) * sizeof(float));
+
+  // Release publishes the samples before the new position
+  atomic_store_explicit(&ring->write_pos, write_pos + count,
+                        memory_order_release);
+  return count;
+}
+
+size_t audio_ring_available(audio_ring *ring) {
+  size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+  size_t write_pos =
+      atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+  return write_pos - read_pos;
+}
+
+bool audio_ring_read(audio_ring *ring, float *samples, size_t count) {
+  size_t read_pos = atomic_load_explicit(&ring->read_pos, memory_order_relaxed);
+  size_t write_pos =
+      atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+  if (write_pos - read_pos < count)
+    return false;
+
+  size_t start = read_pos & ring->mask;
+  size_t first = ring->capacity - start;
+  if (first > count)
+    first = count;
+  memcpy(samples, ring->data + start, first * sizeof(float));
+  memcpy(samples + first, ring->data, (count - first) * sizeof(float));
+
+  // Release hands the space back only after the copy above is done
+  atomic_store_explicit(&ring->read_pos, read_pos + count,
+                        memory_order_release);
+  return true;
+}
@@ -0,0 +1,74 @@
+// Writes a mono 16-bit WAV file with a few harmonics of a base frequency and
+// a slow amplitude wobble, so both the waveform and spectrum rows of an audio
+// channel have something to show. Used by the benchmark suite in place of a
+// bundled audio file.
+//
+// Usage: gen-tone <output.wav> [seconds] [frequency]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SAMPLE_RATE 44100
+#define PI 3.14159265358979323846
+
+static void write_u32(FILE *out, uint32_t value) {
+  unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+  fwrite(bytes, 1, 4, out);
+}
+
+static void write_u16(FILE *out, uint16_t value) {
+  unsigned char bytes[2] = {value, value >> 8};
+  fwrite(bytes, 1, 2, out);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <output.wav> [seconds] [frequency]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  double seconds = argc > 2 ? atof(argv[2]) : 10;
+  double frequency = argc > 3 ? atof(argv[3]) : 440;
+  if (seconds <= 0 || frequency <= 0) {
+    fprintf(stderr, "Seconds and frequency must be numbers >0\n");
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = fopen(argv[1], "wb");
+  if (!out) {
+    perror("Failed to open output");
+    return EXIT_FAILURE;
+  }
+
+  uint32_t samples = (uint32_t)(seconds * SAMPLE_RATE);
+  uint32_t data_size = samples * 2;
+
+  fwrite("RIFF", 1, 4, out);
+  write_u32(out, 36 + data_size);
+  fwrite("WAVEfmt ", 1, 8, out);
+  write_u32(out, 16);              // fmt chunk size
+  write_u16(out, 1);               // PCM
+  write_u16(out, 1);               // Mono
+  write_u32(out, SAMPLE_RATE);     // Sample rate
+  write_u32(out, SAMPLE_RATE * 2); // Byte rate
+  write_u16(out, 2);               // Block align
+  write_u16(out, 16);              // Bits per sample
+  fwrite("data", 1, 4, out);
+  write_u32(out, data_size);
+
+  for (uint32_t i = 0; i < samples; i++) {
+    double t = (double)i / SAMPLE_RATE;
+    double value = 0;
+    for (int harmonic = 1; harmonic <= 4; harmonic++)
+      value += sin(2 * PI * frequency * harmonic * t) / harmonic;
+    value *= 0.4 * (0.75 + 0.25 * sin(2 * PI * 0.5 * t));
+    write_u16(out, (uint16_t)(int16_t)(value * 32767));
+  }
+
+  if (fclose(out) != 0) {
+    perror("Failed to write output");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
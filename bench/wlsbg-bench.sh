@@ -0,0 +1,80 @@
+#!/bin/sh
+# Runs the headless renderer over the bundled examples with a fixed clock and
+# collects every result into one JSON file.
+#
+# Usage: wlsbg-bench.sh <wlsbg> <gen-tone> <source dir> <output dir>
+#
+# WLSBG_BENCH_SIZE (default 1920x1080), WLSBG_BENCH_FRAMES (default 300) and
+# WLSBG_BENCH_TIME_STEP (default 1/60 s) override the run parameters.
+
+set -u
+
+wlsbg=$1
+gen_tone=$2
+examples=$3/examples
+out=$4
+
+size=${WLSBG_BENCH_SIZE:-1920x1080}
+frames=${WLSBG_BENCH_FRAMES:-300}
+time_step=${WLSBG_BENCH_TIME_STEP:-0.0166666667}
+
+mkdir -p "$out/cases" || exit 1
+rm -f "$out"/cases/*.json
+"$gen_tone" "$out/tone.wav" 10 220 || exit 1
+
+failed=""
+
+run() {
+  name=$1
+  shift
+  echo "wlsbg-bench: $name" >&2
+  if ! "$wlsbg" --headless "$size" --frames "$frames" \
+      --time-step "$time_step" --bench-json "$out/cases/$name.json" "$@"; then
+    echo "wlsbg-bench: $name failed" >&2
+    failed="$failed $name"
+  fi
+}
+
+run retro "$examples/retro.frag"
+
+run twopass \
+  -0 "(t:$examples/kiki.jpg bA:$examples/buffer/twopass/bufferA.frag)" \
+  -1 "(bA bB:$examples/buffer/twopass/bufferB.frag)" \
+  -2 "t:$examples/kiki.jpg" \
+  "$examples/buffer/twopass/image.frag"
+
+run multipass \
+  -0 "(bA:$examples/buffer/multipass/bufferA.frag bB:$examples/buffer/multipass/bufferB.frag bB)" \
+  -1 "(bB bC:$examples/buffer/multipass/bufferC.frag bC)" \
+  -2 "(bC bD:$examples/buffer/multipass/bufferD.frag)" \
+  -3 "t:$examples/chars.png" \
+  -s "$examples/buffer/multipass/shared.frag" \
+  "$examples/buffer/multipass/image.frag"
+
+run texture -0 "t:$examples/kiki.jpg" "$examples/pixelate.frag"
+
+run video -0 "v:$examples/buck.mp4" "$examples/video.frag"
+
+run audio -0 "a:$out/tone.wav" "$examples/audio.frag"
+
+# Merge the per-case files into {"cases": {"<name>": {...}, ...}}
+result="$out/wlsbg-bench.json"
+{
+  printf '{\n  "size": "%s",\n  "frames": %s,\n  "cases": {' \
+    "$size" "$frames"
+  separator=""
+  for file in "$out"/cases/*.json; do
+    [ -e "$file" ] || continue
+    name=$(basename "$file" .json)
+    printf '%s\n    "%s": ' "$separator" "$name"
+    printf '%s' "$(sed '2,$s/^/    /' "$file")"
+    separator=","
+  done
+  printf '\n  }\n}\n'
+} > "$result"
+
+echo "wlsbg-bench: results written to $result" >&2
+[ -z "$failed" ] || {
+  echo "wlsbg-bench: failed cases:$failed" >&2
+  exit 1
+}
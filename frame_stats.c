@@ -0,0 +1,70 @@
+#include "frame_stats.h"
+#include <math.h>
+
+static const char *STAT_NAMES[STAT_COUNT] = {
+    [STAT_DISPATCH] = "event dispatch",
+    [STAT_RENDER] = "shader_render",
+    [STAT_AUDIO_UPDATE] = "shader_audio_update",
+    [STAT_VIDEO_UPDATE] = "shader_video_update",
+    [STAT_SWAP] = "eglSwapBuffers",
+};
+
+// Recording only touches these fixed-size tables, so it is cheap enough to
+// stay on all the time
+static struct {
+  frame_histogram histograms[STAT_COUNT];
+  uint64_t frames; // Frames rendered on any output
+  uint64_t missed; // Deadlines that passed without a frame
+} stats;
+
+// Lower bound of a bucket in nanoseconds
+static double bucket_start(int bucket) {
+  return bucket == 0 ? 0 : 1000.0 * pow(2.0, bucket / 2.0);
+}
+
+void frame_stats_add(frame_stat stat, int64_t ns) {
+  frame_histogram *h = &stats.histograms[stat];
+  if (ns < 0)
+    ns = 0;
+
+  int bucket = ns < 1000 ? 0 : (int)(2.0 * log2(ns / 1000.0));
+  if (bucket >= FRAME_STATS_BUCKETS)
+    bucket = FRAME_STATS_BUCKETS - 1;
+  h->buckets[bucket]++;
+
+  if (h->count == 0 || ns < h->min)
+    h->min = ns;
+  if (ns > h->max)
+    h->max = ns;
+  h->total += ns;
+  h->count++;
+}
+
+void frame_stats_frame(int64_t missed) {
+  stats.frames++;
+  stats.missed += missed;
+}
+
+void frame_stats_dump(FILE *out) {
+  fprintf(out, "Frames rendered: %llu, deadlines missed: %llu\n",
+          (unsigned long long)stats.frames, (unsigned long long)stats.missed);
+
+  for (int i = 0; i < STAT_COUNT; i++) {
+    frame_histogram *h = &stats.histograms[i];
+    if (h->count == 0) {
+      fprintf(out, "%s: no samples\n", STAT_NAMES[i]);
+      continue;
+    }
+
+    fprintf(out, "%s: %llu samples, min %.3f ms, mean %.3f ms, max %.3f ms\n",
+            STAT_NAMES[i], (unsigned long long)h->count, h->min / 1e6,
+            (double)h->total / h->count / 1e6, h->max / 1e6);
+    for (int b = 0; b < FRAME_STATS_BUCKETS; b++) {
+      if (h->buckets[b] == 0)
+        continue;
+      fprintf(out, "  >= %9.3f ms  %llu\n", bucket_start(b) / 1e6,
+              (unsigned long long)h->buckets[b]);
+    }
+  }
+  fflush(out);
+}
@@ -0,0 +1,115 @@
+#include "gl_state.h"
+#include <GLES3/gl3.h>
+#include <string.h>
+
+static gl_state state;
+
+// Forget everything, e.g. after code outside the cache (mpv, texture uploads,
+// resource creation) changed bindings behind its back
+void gl_state_invalidate() { state.valid = false; }
+
+void gl_state_begin_frame() {
+  state.last_issued = state.issued;
+  state.last_skipped = state.skipped;
+  state.issued = 0;
+  state.skipped = 0;
+}
+
+const gl_state *gl_state_get() { return &state; }
+
+static void ensure_valid() {
+  if (state.valid)
+    return;
+
+  // Use values no real binding has so the next call of each kind is issued
+  state.program = (GLuint)-1;
+  state.framebuffer = (GLuint)-1;
+  state.vertex_array = (GLuint)-1;
+  state.viewport[2] = -1;
+  state.active_texture = 0;
+  memset(state.texture, 0xff, sizeof(state.texture));
+  memset(state.uniform_range, 0xff, sizeof(state.uniform_range));
+  state.valid = true;
+}
+
+void gl_count_call() { state.issued++; }
+
+void gl_use_program(GLuint program) {
+  ensure_valid();
+  if (state.program == program) {
+    state.skipped++;
+    return;
+  }
+  glUseProgram(program);
+  state.program = program;
+  state.issued++;
+}
+
+void gl_bind_framebuffer(GLuint framebuffer) {
+  ensure_valid();
+  if (state.framebuffer == framebuffer) {
+    state.skipped++;
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  state.framebuffer = framebuffer;
+  state.issued++;
+}
+
+void gl_bind_vertex_array(GLuint vertex_array) {
+  ensure_valid();
+  if (state.vertex_array == vertex_array) {
+    state.skipped++;
+    return;
+  }
+  glBindVertexArray(vertex_array);
+  state.vertex_array = vertex_array;
+  state.issued++;
+}
+
+void gl_viewport(GLint x, GLint y, GLint width, GLint height) {
+  ensure_valid();
+  if (state.viewport[0] == x && state.viewport[1] == y &&
+      state.viewport[2] == width && state.viewport[3] == height) {
+    state.skipped++;
+    return;
+  }
+  glViewport(x, y, width, height);
+  state.viewport[0] = x;
+  state.viewport[1] = y;
+  state.viewport[2] = width;
+  state.viewport[3] = height;
+  state.issued++;
+}
+
+void gl_bind_texture_unit(int unit, GLuint texture) {
+  ensure_valid();
+  if (state.texture[unit] == texture) {
+    state.skipped++;
+    return;
+  }
+  if (state.active_texture != GL_TEXTURE0 + (GLenum)unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    state.active_texture = GL_TEXTURE0 + unit;
+    state.issued++;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  state.texture[unit] = texture;
+  state.issued++;
+}
+
+void gl_bind_uniform_range(GLuint binding, GLuint buffer, size_t offset,
+                           size_t size) {
+  ensure_valid();
+  if (state.uniform_range[binding].buffer == buffer &&
+      state.uniform_range[binding].offset == offset &&
+      state.uniform_range[binding].size == size) {
+    state.skipped++;
+    return;
+  }
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+  state.uniform_range[binding].buffer = buffer;
+  state.uniform_range[binding].offset = offset;
+  state.uniform_range[binding].size = size;
+  state.issued++;
+}
@@ -0,0 +1,159 @@
+#include "gpu_timer.h"
+#include <EGL/egl.h>
+#include <GLES3/gl3.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+typedef void (*get_query_object_ui64v_fn)(GLuint id, GLenum pname,
+                                          uint64_t *params);
+
+static get_query_object_ui64v_fn get_query_object_ui64v = NULL;
+
+// Set when the GPU reported a disjoint event (clock change, reset) this frame,
+// which makes every result that came back meanwhile meaningless
+static bool disjoint = false;
+
+bool gpu_timer_supported() {
+  if (get_query_object_ui64v)
+    return true;
+
+  bool found = false;
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count && !found; i++) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    found = ext && strcmp(ext, "GL_EXT_disjoint_timer_query") == 0;
+  }
+  if (!found)
+    return false;
+
+  get_query_object_ui64v = (get_query_object_ui64v_fn)eglGetProcAddress(
+      "glGetQueryObjectui64vEXT");
+  return get_query_object_ui64v != NULL;
+}
+
+void gpu_timer_begin_frame() {
+  GLint value = 0;
+  glGetIntegerv(GL_GPU_DISJOINT_EXT, &value);
+  disjoint = value != 0;
+}
+
+gpu_timer *gpu_timer_create(const char *label) {
+  gpu_timer *timer = calloc(1, sizeof(gpu_timer));
+  if (!timer)
+    return NULL;
+
+  timer->label = strdup(label ? label : "");
+  if (!timer->label) {
+    free(timer);
+    return NULL;
+  }
+  timer->current = -1;
+  glGenQueries(GPU_TIMER_QUERIES, timer->queries);
+  return timer;
+}
+
+void gpu_timer_begin(gpu_timer *timer) {
+  if (!timer || timer->pending[timer->next])
+    return;
+
+  timer->current = timer->next;
+  glBeginQuery(GL_TIME_ELAPSED_EXT, timer->queries[timer->current]);
+}
+
+void gpu_timer_end(gpu_timer *timer) {
+  if (!timer || timer->current < 0)
+    return;
+
+  glEndQuery(GL_TIME_ELAPSED_EXT);
+  timer->pending[timer->current] = true;
+  timer->next = (timer->current + 1) % GPU_TIMER_QUERIES;
+  timer->current = -1;
+}
+
+// Reads back every query whose result is already available, oldest first
+void gpu_timer_collect(gpu_timer *timer) {
+  if (!timer)
+    return;
+
+  for (int n = 0; n < GPU_TIMER_QUERIES; n++) {
+    int i = (timer->next + n) % GPU_TIMER_QUERIES;
+    if (!timer->pending[i])
+      continue;
+
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(timer->queries[i], GL_QUERY_RESULT_AVAILABLE,
+                        &available);
+    if (!available)
+      continue;
+
+    uint64_t elapsed = 0;
+    get_query_object_ui64v(timer->queries[i], GL_QUERY_RESULT, &elapsed);
+    timer->pending[i] = false;
+    if (disjoint)
+      continue;
+
+    timer->samples[timer->sample_next] = elapsed / 1e6f;
+    timer->sample_next = (timer->sample_next + 1) % GPU_TIMER_WINDOW;
+    if (timer->sample_count < GPU_TIMER_WINDOW)
+      timer->sample_count++;
+  }
+}
+
+static int compare_float(const void *a, const void *b) {
+  float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+// Statistics over the current window, false if it holds no samples
+bool gpu_timer_summarize(gpu_timer *timer, gpu_timer_summary *summary) {
+  if (!timer || timer->sample_count == 0)
+    return false;
+
+  float sorted[GPU_TIMER_WINDOW];
+  memcpy(sorted, timer->samples, timer->sample_count * sizeof(float));
+  qsort(sorted, timer->sample_count, sizeof(float), compare_float);
+
+  double sum = 0;
+  for (int i = 0; i < timer->sample_count; i++)
+    sum += sorted[i];
+  int last = timer->sample_count - 1;
+
+  summary->mean = sum / timer->sample_count;
+  summary->p95 = sorted[(int)(last * 0.95 + 0.5)];
+  summary->p99 = sorted[(int)(last * 0.99 + 0.5)];
+  summary->samples = timer->sample_count;
+  return true;
+}
+
+void gpu_timer_report(gpu_timer *timer, FILE *out) {
+  if (!timer)
+    return;
+
+  gpu_timer_summary summary;
+  if (!gpu_timer_summarize(timer, &summary)) {
+    fprintf(out, "  %-40s no samples\n", timer->label);
+    return;
+  }
+
+  fprintf(out, "  %-40s mean %7.3f ms  p95 %7.3f ms  p99 %7.3f ms  (%d)\n",
+          timer->label, summary.mean, summary.p95, summary.p99,
+          summary.samples);
+}
+
+void gpu_timer_free(gpu_timer *timer) {
+  if (!timer)
+    return;
+
+  glDeleteQueries(GPU_TIMER_QUERIES, timer->queries);
+  free(timer->label);
+  free(timer);
+}
@@ -0,0 +1,187 @@
+#include "image_file.h"
+#include "stb_image.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest payload of a stored (uncompressed) deflate block
+#define DEFLATE_BLOCK_SIZE 65535
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char *data,
+                             size_t size) {
+  if (crc_table[1] == 0) {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      crc_table[n] = c;
+    }
+  }
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+static bool write_chunk(FILE *file, const char *type,
+                        const unsigned char *data, size_t size) {
+  unsigned char header[8];
+  put_u32(header, size);
+  memcpy(header + 4, type, 4);
+
+  unsigned char footer[4];
+  uint32_t crc = crc32_update(0, header + 4, 4);
+  put_u32(footer, crc32_update(crc, data, size));
+
+  return fwrite(header, 1, 8, file) == 8 &&
+         (size == 0 || fwrite(data, 1, size, file) == size) &&
+         fwrite(footer, 1, 4, file) == 4;
+}
+
+// Lossless but unfiltered and uncompressed, which keeps the encoder tiny;
+// these files are for comparing renders, not for distribution
+static bool write_png(FILE *file, const unsigned char *rgba, int width,
+                      int height) {
+  size_t row_size = (size_t)width * 4 + 1; // Leading filter type byte
+  size_t raw_size = row_size * height;
+  size_t blocks = (raw_size + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE;
+  size_t zlib_size = 2 + raw_size + blocks * 5 + 4;
+
+  unsigned char *raw = malloc(raw_size);
+  unsigned char *zlib = malloc(zlib_size);
+  if (!raw || !zlib) {
+    free(raw);
+    free(zlib);
+    return false;
+  }
+
+  for (int y = 0; y < height; y++) {
+    raw[y * row_size] = 0;
+    memcpy(raw + y * row_size + 1, rgba + (size_t)y * width * 4, width * 4);
+  }
+
+  // zlib stream made of stored deflate blocks
+  unsigned char *out = zlib;
+  *out++ = 0x78;
+  *out++ = 0x01;
+  uint32_t a = 1, b = 0;
+  for (size_t offset = 0; offset < raw_size; offset += DEFLATE_BLOCK_SIZE) {
+    size_t size = raw_size - offset;
+    if (size > DEFLATE_BLOCK_SIZE)
+      size = DEFLATE_BLOCK_SIZE;
+    *out++ = offset + size == raw_size; // BFINAL, BTYPE 00
+    *out++ = size & 0xff;
+    *out++ = size >> 8;
+    *out++ = ~size & 0xff;
+    *out++ = (~size >> 8) & 0xff;
+    memcpy(out, raw + offset, size);
+    out += size;
+
+    for (size_t i = 0; i < size; i++) {
+      a = (a + raw[offset + i]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  put_u32(out, (b << 16) | a);
+
+  unsigned char ihdr[13];
+  put_u32(ihdr, width);
+  put_u32(ihdr + 4, height);
+  ihdr[8] = 8;  // Bit depth
+  ihdr[9] = 6;  // RGBA
+  ihdr[10] = 0; // Deflate
+  ihdr[11] = 0; // Adaptive filtering
+  ihdr[12] = 0; // No interlace
+
+  static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                             '\r', '\n', 0x1a, '\n'};
+  bool ok = fwrite(signature, 1, 8, file) == 8 &&
+            write_chunk(file, "IHDR", ihdr, sizeof(ihdr)) &&
+            write_chunk(file, "IDAT", zlib, zlib_size) &&
+            write_chunk(file, "IEND", NULL, 0);
+
+  free(raw);
+  free(zlib);
+  return ok;
+}
+
+// Writes a PNG when the path ends in .png, raw RGBA bytes otherwise
+bool write_image(const char *path, const unsigned char *rgba, int width,
+                 int height) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "Failed to open '%s' for writing\n", path);
+    return false;
+  }
+
+  size_t length = strlen(path);
+  bool ok;
+  if (length > 4 && strcmp(path + length - 4, ".png") == 0) {
+    ok = write_png(file, rgba, width, height);
+  } else {
+    size_t size = (size_t)width * height * 4;
+    ok = fwrite(rgba, 1, size, file) == size;
+  }
+
+  if (fclose(file) != 0 || !ok) {
+    fprintf(stderr, "Failed to write '%s'\n", path);
+    return false;
+  }
+  return true;
+}
+
+// Returns whether every channel of every pixel is within tolerance of the
+// image stored at path, reporting the differences otherwise
+bool compare_image(const char *path, const unsigned char *rgba, int width,
+                   int height, int tolerance) {
+  int ref_width, ref_height;
+  stbi_set_flip_vertically_on_load(false);
+  unsigned char *ref =
+      stbi_load(path, &ref_width, &ref_height, NULL, STBI_rgb_alpha);
+  if (!ref) {
+    fprintf(stderr, "Failed to load reference image '%s'\n", path);
+    return false;
+  }
+  if (ref_width != width || ref_height != height) {
+    fprintf(stderr, "Reference '%s' is %dx%d, rendered %dx%d\n", path,
+            ref_width, ref_height, width, height);
+    stbi_image_free(ref);
+    return false;
+  }
+
+  int max_diff = 0;
+  size_t mismatched = 0;
+  for (size_t i = 0; i < (size_t)width * height; i++) {
+    bool pixel_differs = false;
+    for (int c = 0; c < 4; c++) {
+      int diff = abs(rgba[i * 4 + c] - ref[i * 4 + c]);
+      if (diff > max_diff)
+        max_diff = diff;
+      pixel_differs |= diff > tolerance;
+    }
+    mismatched += pixel_differs;
+  }
+  stbi_image_free(ref);
+
+  if (mismatched > 0) {
+    fprintf(stderr,
+            "Render differs from '%s': %zu pixels beyond tolerance %d, "
+            "largest difference %d\n",
+            path, mismatched, tolerance, max_diff);
+    return false;
+  }
+  fprintf(stderr, "Render matches '%s' (largest difference %d)\n", path,
+          max_diff);
+  return true;
+}
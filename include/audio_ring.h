@@ -0,0 +1,37 @@
+#ifndef H_AUDIO_RING
+#define H_AUDIO_RING
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Single-producer/single-consumer queue of samples. The producer is the
+// real-time audio thread and must never block, so neither side takes a lock:
+// each one only stores its own position and loads the other's.
+struct _audio_ring {
+  float *data;
+  size_t capacity; // Power of two
+  size_t mask;     // capacity - 1
+
+  // Total samples ever written/read; they wrap with size_t and are masked
+  // into data on access
+  _Atomic size_t write_pos;
+  _Atomic size_t read_pos;
+};
+
+typedef struct _audio_ring audio_ring;
+
+// Allocates room for at least min_capacity samples
+bool audio_ring_init(audio_ring *ring, size_t min_capacity);
+void audio_ring_free(audio_ring *ring);
+
+// Producer side. Samples that do not fit are dropped, returns how many were
+// written.
+size_t audio_ring_write(audio_ring *ring, const float *samples, size_t count);
+
+// Consumer side
+size_t audio_ring_available(audio_ring *ring);
+// Copies out exactly count samples, or nothing if fewer are available
+bool audio_ring_read(audio_ring *ring, float *samples, size_t count);
+
+#endif
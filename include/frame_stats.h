@@ -0,0 +1,35 @@
+#ifndef H_FRAME_STATS
+#define H_FRAME_STATS
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Parts of the main loop whose wall time is recorded
+enum _frame_stat {
+  STAT_DISPATCH,     // Reading and dispatching Wayland events
+  STAT_RENDER,       // shader_render, including the swap
+  STAT_AUDIO_UPDATE, // shader_audio_update
+  STAT_VIDEO_UPDATE, // shader_video_update
+  STAT_SWAP,         // eglSwapBuffers
+  STAT_COUNT
+};
+
+typedef enum _frame_stat frame_stat;
+
+// Buckets are half powers of two of a microsecond, so the last one starts at
+// about 0.74 seconds
+#define FRAME_STATS_BUCKETS 40
+
+struct _frame_histogram {
+  uint64_t buckets[FRAME_STATS_BUCKETS];
+  uint64_t count;
+  int64_t total, min, max; // Nanoseconds
+};
+
+typedef struct _frame_histogram frame_histogram;
+
+void frame_stats_add(frame_stat stat, int64_t ns);
+void frame_stats_frame(int64_t missed);
+void frame_stats_dump(FILE *out);
+
+#endif
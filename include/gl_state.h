@@ -0,0 +1,46 @@
+#ifndef H_GL_STATE
+#define H_GL_STATE
+
+#include <GL/gl.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define GL_STATE_TEXTURE_UNITS 10
+#define GL_STATE_UNIFORM_BINDINGS 2
+
+// Shadow copy of the GL state touched while rendering passes. Every wlsbg
+// surface shares one context, so a single cache covers all of them.
+struct _gl_state {
+  bool valid;
+  GLuint program;
+  GLuint framebuffer;
+  GLuint vertex_array;
+  GLint viewport[4];
+  GLenum active_texture;
+  GLuint texture[GL_STATE_TEXTURE_UNITS];
+  struct {
+    GLuint buffer;
+    size_t offset, size;
+  } uniform_range[GL_STATE_UNIFORM_BINDINGS];
+
+  // GL calls issued and skipped as redundant, for the current and last frame
+  unsigned int issued, skipped;
+  unsigned int last_issued, last_skipped;
+};
+
+typedef struct _gl_state gl_state;
+
+void gl_state_invalidate();
+void gl_state_begin_frame();
+const gl_state *gl_state_get();
+
+void gl_use_program(GLuint program);
+void gl_bind_framebuffer(GLuint framebuffer);
+void gl_bind_vertex_array(GLuint vertex_array);
+void gl_viewport(GLint x, GLint y, GLint width, GLint height);
+void gl_bind_texture_unit(int unit, GLuint texture);
+void gl_bind_uniform_range(GLuint binding, GLuint buffer, size_t offset,
+                           size_t size);
+void gl_count_call();
+
+#endif
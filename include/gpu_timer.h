@@ -0,0 +1,45 @@
+#ifndef H_GPU_TIMER
+#define H_GPU_TIMER
+
+#include <GL/gl.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define GPU_TIMER_QUERIES 4  // Frames a result may take to come back
+#define GPU_TIMER_WINDOW 240 // Samples kept for the rolling statistics
+
+// GPU time of one span of commands, measured with GL_EXT_disjoint_timer_query.
+// Results are only read once available, so timing never stalls rendering; a
+// frame whose query slot is still busy is simply not measured.
+struct _gpu_timer {
+  char *label;
+  GLuint queries[GPU_TIMER_QUERIES];
+  bool pending[GPU_TIMER_QUERIES];
+  int next;    // Query slot used by the next begin
+  int current; // Slot being recorded, -1 if none
+
+  float samples[GPU_TIMER_WINDOW]; // Milliseconds, oldest overwritten first
+  int sample_count, sample_next;
+};
+
+typedef struct _gpu_timer gpu_timer;
+
+struct _gpu_timer_summary {
+  double mean, p95, p99; // Milliseconds
+  int samples;
+};
+
+typedef struct _gpu_timer_summary gpu_timer_summary;
+
+bool gpu_timer_supported();
+void gpu_timer_begin_frame();
+
+gpu_timer *gpu_timer_create(const char *label);
+void gpu_timer_begin(gpu_timer *timer);
+void gpu_timer_end(gpu_timer *timer);
+void gpu_timer_collect(gpu_timer *timer);
+bool gpu_timer_summarize(gpu_timer *timer, gpu_timer_summary *summary);
+void gpu_timer_report(gpu_timer *timer, FILE *out);
+void gpu_timer_free(gpu_timer *timer);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef H_IMAGE_FILE
+#define H_IMAGE_FILE
+
+#include <stdbool.h>
+
+// Pixels are 8-bit RGBA, top row first
+
+bool write_image(const char *path, const unsigned char *rgba, int width,
+                 int height);
+
+bool compare_image(const char *path, const unsigned char *rgba, int width,
+                   int height, int tolerance);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef H_PROGRAM_CACHE
+#define H_PROGRAM_CACHE
+
+#include <GL/gl.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Linked programs are kept on disk as driver binaries, keyed by a hash of
+// their sources and the GL implementation that produced them
+
+uint64_t program_cache_key(const char *vertex_source,
+                           const char *fragment_source);
+
+bool program_cache_load(GLuint *program, uint64_t key);
+
+void program_cache_store(GLuint program, uint64_t key);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef H_RENDER_GRAPH
+#define H_RENDER_GRAPH
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct _shader_buffer shader_buffer;
+
+// One buffer render, with an edge for every buffer channel it samples
+struct _render_pass {
+  shader_buffer *buf;
+  int source[10];       // Pass index sampled by each channel, -1 if none
+  bool feedback[10];    // Channel samples its source's previous frame
+  bool feedback_source; // Some pass (maybe itself) reads its previous frame
+};
+
+typedef struct _render_pass render_pass;
+
+// Flat, topologically sorted pass list; the main image is the last pass
+struct _render_graph {
+  render_pass *passes;
+  int pass_count;
+};
+
+typedef struct _render_graph render_graph;
+
+render_graph *render_graph_compile(shader_buffer *main_buf);
+void render_graph_dump(render_graph *graph, FILE *out);
+void render_graph_free(render_graph *graph);
+
+#endif
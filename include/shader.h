@@ -5,24 +5,41 @@
 #include <EGL/eglext.h>
 #include <GL/gl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <time.h>
 #include <wayland-client-protocol.h>
 
 typedef struct _resource_registry resource_registry;
+typedef struct _render_graph render_graph;
+typedef struct _shader_watch shader_watch;
+typedef struct _gpu_timer gpu_timer;
 typedef struct _shader_buffer shader_buffer;
+typedef struct _shader_target shader_target;
 typedef struct _iMouse iMouse;
 
+// Process-wide GPU state: one EGL display and context shared by every output,
+// owning the compiled programs and all channel resources.
 struct _shader_context {
   EGLDisplay egl_display;
   EGLContext egl_context;
   EGLConfig egl_config;
-  struct wl_egl_window *egl_window;
-  EGLSurface egl_surface;
 
   GLuint vao, vbo;
 
   resource_registry *registry;
-  shader_buffer *buf;
+  shader_buffer *buf; // Main image buffer
+
+  // Compiled pass order; pass i renders the buffer whose index is i
+  render_graph *graph;
+
+  char *shared_shader_path;
+  shader_watch *watch; // Shader files rebuilt when they change on disk
+
+  // GPU timing, only allocated when profiling
+  bool profiling;
+  gpu_timer **video_timers; // One per video in registry order
+  int video_timer_count;
 
   struct {
     GLuint tex;            // Keyboard state texture
@@ -32,20 +49,85 @@ struct _shader_context {
   } keyboard;
 
   bool initialized;
+  bool ready;     // Every pass has a linked program
+  bool presented; // A placeholder frame has been shown
 };
 
 typedef struct _shader_context shader_context;
 
-shader_context *shader_create(struct wl_display *display,
-                              struct wl_surface *surface, char *shader_path,
-                              char *shared_shader_path, int width, int height,
+// A program whose compile and link were submitted but not yet checked
+struct _shader_program_build {
+  GLuint program;
+  GLuint vertex_shader, fragment_shader;
+  uint64_t cache_key;
+  bool cached; // Restored from the binary cache, already linked
+};
+
+typedef struct _shader_program_build shader_program_build;
+
+// Per-output state: the window surface and the render targets of every buffer
+// at this output's resolution.
+struct _shader_surface {
+  shader_context *ctx;
+  struct wl_egl_window *egl_window;
+  EGLSurface egl_surface;
+  int width, height;
+  shader_target *targets; // Indexed by pass, see shader_buffer::index
+
+  unsigned int frame; // Frame counter
+  double last_time;   // For calculating delta time
+
+  // Uniform buffer holding the frame block followed by one block per pass
+  GLuint ubo;
+  unsigned char *uniform_data;
+  size_t uniform_size;
+  size_t pass_uniform_offset;
+  size_t pass_uniform_stride;
+
+  gpu_timer **pass_timers; // Indexed by pass, NULL unless profiling
+  gpu_timer *blit_timer;
+};
+
+typedef struct _shader_surface shader_surface;
+
+shader_context *shader_create(struct wl_display *display, char *shader_path,
+                              char *shared_shader_path,
                               char *channel_input[10]);
-void shader_render(shader_context *ctx, struct timespec start_time,
-                   iMouse *mouse);
-void shader_resize(shader_context *ctx, int width, int height);
+bool shader_update(shader_context *ctx, struct timespec start_time);
+shader_context *shader_create_headless(char *shader_path,
+                                       char *shared_shader_path,
+                                       char *channel_input[10],
+                                       bool *unavailable);
+bool shader_wait_ready(shader_context *ctx);
+void shader_finish(shader_context *ctx);
 void shader_destroy(shader_context *ctx);
+int shader_watch_fd(shader_context *ctx);
+void shader_reload(shader_context *ctx);
+bool shader_enable_profiling(shader_context *ctx);
+int64_t shader_free_video_memory(shader_context *ctx);
+void shader_report_profile(shader_context *ctx, FILE *out);
+
+shader_surface *shader_surface_create(shader_context *ctx,
+                                      struct wl_surface *surface, int width,
+                                      int height);
+shader_surface *shader_surface_create_offscreen(shader_context *ctx, int width,
+                                                int height);
+GLuint shader_surface_main_texture(shader_surface *surface);
+bool shader_surface_read_pixels(shader_surface *surface, unsigned char *rgba);
+void shader_render(shader_surface *surface, struct timespec start_time,
+                   iMouse *mouse);
+void shader_surface_resize(shader_surface *surface, int width, int height);
+void shader_surface_destroy(shader_surface *surface);
+void shader_surface_collect_profile(shader_surface *surface);
+void shader_surface_report_profile(shader_surface *surface, const char *name,
+                                   FILE *out);
 
 GLuint compile_shader(GLenum type, const char *source);
+shader_program_build *submit_program(char *shader_path,
+                                     char *shared_shader_path);
+bool program_build_done(shader_program_build *build);
+bool finish_program(shader_program_build *build, GLuint *program);
+void cancel_program(shader_program_build *build);
 bool compile_and_link_program(GLuint *program, char *shader_path,
                               char *shared_shader_path);
 
@@ -1,21 +1,38 @@
 #ifndef SHADER_AUDIO_H
 #define SHADER_AUDIO_H
 
+#include "audio_ring.h"
 #include "miniaudio.h"
+#include "shader_channel.h"
 #include <GLES3/gl3.h>
 #include <fftw3.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
-#define AUDIO_BUFFER_SIZE 1024
+#define AUDIO_BUFFER_SIZE 1024 // Default FFT size in frames
+#define AUDIO_FFT_MIN 64
+#define AUDIO_FFT_MAX 16384
 #define AUDIO_TEXTURE_WIDTH 512
 #define AUDIO_TEXTURE_HEIGHT 2
+#define AUDIO_TEXTURE_SIZE (AUDIO_TEXTURE_WIDTH * AUDIO_TEXTURE_HEIGHT)
+#define AUDIO_HISTORY_MAX 1024
+#define AUDIO_HISTORY_QUEUE 64 // Spectrum rows in flight between frames
 
 struct _shader_audio {
   char *path;
+  dev_t file_device; // Identify the file among shared sources
+  ino_t file_inode;
+  int refs; // Channels using this source
+  struct _shader_audio *next;
   ma_decoder decoder;
   ma_device device;
   bool is_playing;
+  bool silent;        // No playback device, see silent_thread
+  bool capture;       // Live input, path names the capture device
+  ma_context context; // Capture only
   ma_format format;
   ma_uint32 channels;
   ma_uint32 sample_rate;
@@ -23,32 +40,66 @@ struct _shader_audio {
   struct timespec start_time;
   double seek_threshold;
 
-  // Circular buffer
-  float *circular_buffer;
-  size_t circular_buffer_size;
-  size_t write_pos;
-  size_t read_pos;
-  pthread_mutex_t buffer_mutex;
+  // Fixed clock: time of the window last decoded
+  bool stepped;
+  double step_time;
 
-  // Processing buffers
+  // Samples from the playback callback, read by the analysis thread
+  audio_ring ring;
+  sem_t samples_ready; // Posted by the callback after every write
+
+  // Analysis thread, which owns everything down to the FFT while playing
+  pthread_t analysis;
+  atomic_bool analysis_running;
+  bool analysis_started;
+
+  // Processing buffers, audio_buffer is a window of fft_size frames that
+  // advances hop_size frames per analysis
+  int fft_size;
+  int hop_size;
   float *audio_buffer;
-  float *waveform_data;
-  float *frequency_data;
   float *frequency_smoothed;
 
-  // FFT
-  fftwf_complex *fft_in;
-  fftwf_complex *fft_out;
+  // Real-input FFT of the windowed mono mix
+  float *window;     // Hann window, fft_size coefficients
+  float window_gain; // Sum of the window, normalizes magnitudes
+  float *fft_in;
+  fftwf_complex *fft_out; // fft_size / 2 + 1 bins
   fftwf_plan fft_plan;
 
-  // OpenGL texture
+  // Triple buffer of texture rows. The analysis thread fills rows_back and
+  // the renderer uploads rows_front; finished rows are passed between them by
+  // swapping indices through rows_middle, whose ROWS_FRESH bit is set until
+  // the renderer takes them.
+  float *rows[3];
+  atomic_uint rows_middle;
+  unsigned rows_back;
+  unsigned rows_front;
+
+  // OpenGL texture: waveform and spectrum rows, then with a[history=N] a ring
+  // of the last N spectrum rows
   GLuint tex_id;
+  int texture_height;
+  int history;
+  int history_row;          // Newest row of the ring, 0..history-1
+  audio_ring history_queue; // Spectrum rows from the analysis thread
 };
 
 typedef struct _shader_audio shader_audio;
 
-shader_audio *shader_audio_create(char *path);
+// Takes ownership of path on success. Returns the already loaded source when
+// another channel uses the same file.
+shader_audio *shader_audio_create(char *path,
+                                  const shader_channel_options *options);
+// Captures from the first device whose name contains name, "default" for the
+// system default, or "null" for silence from miniaudio's null backend. Takes
+// ownership of name on success.
+shader_audio *
+shader_audio_create_capture(char *name, const shader_channel_options *options);
 void shader_audio_update(shader_audio *audio, struct timespec start_time);
 void shader_audio_destroy(shader_audio *audio);
 
+// Makes channels created afterwards silent, for --mute
+void shader_audio_set_muted(bool mute);
+
 #endif
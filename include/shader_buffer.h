@@ -7,29 +7,59 @@
 
 typedef struct _shader_channel shader_channel;
 typedef struct _shader_uniform shader_uniform;
-typedef struct _shader_context shader_context;
+typedef struct _shader_surface shader_surface;
+typedef struct _render_pass render_pass;
 typedef struct _iMouse iMouse;
+typedef struct _shader_program_build shader_program_build;
 
+// Color format of a buffer's render textures
+struct _buffer_format {
+  const char *name;
+  GLenum internal_format;
+  GLenum format;
+  GLenum type;
+};
+
+typedef struct _buffer_format buffer_format;
+
+// Shared part of a buffer: the compiled program and its inputs
 struct _shader_buffer {
-  int width, height;
-  unsigned int frame; // Frame counter
-  double last_time;   // For calculating delta time
+  int index; // Render graph pass index, also its slot in each surface
   char *shader_path;
+  float scale; // Resolution relative to the output
+  const buffer_format *format;
   GLuint program;
-  GLuint fbo;
-  GLuint textures[2];  // Double-buffered textures
-  int current_texture; // 0 or 1
+  shader_program_build *build;  // Pending compile, NULL once collected
+  shader_program_build *reload; // Replacement for a changed source file
   shader_channel *channel[10];
   shader_uniform *u;
-  bool render_parity;
 };
 
 typedef struct _shader_buffer shader_buffer;
 
+// Per-output part of a buffer: what it renders into on one surface
+struct _shader_target {
+  int width, height;
+  GLuint fbo[2];       // One framebuffer per texture
+  GLuint textures[2];  // Second texture only exists for feedback sources
+  int texture_count;   // 2 if the previous frame must be kept, 1 otherwise,
+                       // 0 when rendering straight into the window
+  int current_texture; // Texture holding the latest rendered frame
+};
+
+typedef struct _shader_target shader_target;
+
+const buffer_format *find_buffer_format(const char *name);
+const buffer_format *default_buffer_format();
+
 void free_shader_buffer(shader_buffer *buf);
-bool init_shader_buffer(shader_buffer *buf, int width, int height,
-                        char *shared_shader_path);
-void render_shader_buffer(shader_context *ctx, shader_buffer *buf,
-                          struct timespec start_time, iMouse *mouse);
+bool init_shader_buffer(shader_buffer *buf, char *shared_shader_path);
+void render_shader_buffer(shader_surface *surface, render_pass *pass);
+
+bool init_shader_target(shader_target *target, render_pass *pass, int width,
+                        int height, bool window);
+void resize_shader_target(shader_target *target, render_pass *pass, int width,
+                          int height);
+void free_shader_target(shader_target *target);
 
 #endif
@@ -9,6 +9,7 @@ typedef struct _shader_texture shader_texture;
 typedef struct _shader_buffer shader_buffer;
 typedef struct _shader_video shader_video;
 typedef struct _shader_audio shader_audio;
+typedef struct _buffer_format buffer_format;
 
 enum _shader_channel_type { NONE, BUFFER, TEXTURE, VIDEO, AUDIO };
 typedef enum _shader_channel_type shader_channel_type;
@@ -26,10 +27,21 @@ struct _shader_channel {
 
 typedef struct _shader_channel shader_channel;
 
+// Per-resource options given as `<T>Name[key=value,...]:<path>`
+struct _shader_channel_options {
+  float scale;                 // Buffer resolution relative to the output
+  const buffer_format *format; // Buffer texture format
+  int fft_size;                // Audio FFT size in frames
+  bool silent;                 // Analyze audio without playing it
+  bool capture;                // Audio path names a capture device
+  int history;                 // Audio spectrum rows kept in the texture
+};
+
+typedef struct _shader_channel_options shader_channel_options;
+
 shader_channel *parse_channel_input(const char *input,
                                     resource_registry **registry_pointer);
 void free_shader_channel(shader_channel *channel);
-bool init_channel_recursive(shader_channel *channel, int width, int height,
-                            char *shared_shader_path);
+bool init_channel_recursive(shader_channel *channel, char *shared_shader_path);
 
 #endif
@@ -2,9 +2,17 @@
 #define H_SHADER_UNIFORM
 
 #include <GL/gl.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 
 typedef struct _shader_buffer shader_buffer;
+typedef struct _shader_surface shader_surface;
+typedef struct _render_pass render_pass;
+
+// Uniform buffer binding points shared by every program
+#define FRAME_UNIFORM_BINDING 0
+#define PASS_UNIFORM_BINDING 1
 
 struct _iMouse {
   float real_x;
@@ -17,24 +25,41 @@ struct _iMouse {
 
 typedef struct _iMouse iMouse;
 
+// std140 mirror of the WlsbgFrame block, identical for every pass of a frame
+struct _frame_uniforms {
+  float date[4];    // iDate
+  float time;       // iTime
+  float time_delta; // iTimeDelta
+  float frame_rate; // iFrameRate
+  int32_t frame;    // iFrame
+};
+
+typedef struct _frame_uniforms frame_uniforms;
+
+// std140 mirror of the WlsbgPass block, one per render pass
+struct _pass_uniforms {
+  float resolution[4];              // iResolution
+  float mouse[4];                   // iMouse
+  float mouse_pos[4];               // iMousePos
+  float channel_resolution[10][4];  // iChannelResolution
+  float channel_duration[10][4];    // iChannelDuration
+  float channel_history_row[10][4]; // iChannelHistoryRow
+};
+
+typedef struct _pass_uniforms pass_uniforms;
+
 struct _shader_uniform {
-  GLint resolution;      // Uniform location for iResolution
-  GLint time;            // Uniform location for iTime
-  GLint time_delta;      // Uniform location for iTimeDelta
-  GLint mouse;           // Uniform location for iMouse
-  GLint mouse_pos;       // Uniform location for iMousePos
-  GLint frame;           // Uniform location for iFrame
-  GLint frame_rate;      // Uniform location for iFrameRate
-  GLint date;            // Uniform location for iDate
-  GLint channel[10];     // Uniform locations for iChannel
-  GLint channel_res[10]; // Uniform locations for iChannelResolution
-  GLint channel_dur[10]; // Uniform locations for iChannelDuration
+  GLint channel[10]; // Uniform locations for iChannel
 };
 
 typedef struct _shader_uniform shader_uniform;
 
 void set_uniform_locations(GLuint program, shader_uniform *u);
-void set_uniforms(shader_buffer *buf, struct timespec start_time,
-                  iMouse *mouse);
+
+bool init_uniform_buffer(shader_surface *surface);
+void free_uniform_buffer(shader_surface *surface);
+void update_uniform_buffer(shader_surface *surface, double elapsed_time,
+                           iMouse *mouse);
+void bind_pass_uniforms(shader_surface *surface, render_pass *pass);
 
 #endif
@@ -24,6 +24,11 @@ struct _shader_video {
   bool fbo_configured;
   bool playing;
   bool seeking;
+
+  // Fixed-clock stepping, see step_video
+  double step_time;   // Position of the last stepped seek
+  bool stepped;       // step_time is valid
+  bool frame_pending; // Seeked frame not rendered yet
 };
 
 typedef struct _shader_video shader_video;
@@ -0,0 +1,34 @@
+#ifndef H_SHADER_WATCH
+#define H_SHADER_WATCH
+
+#include <stdbool.h>
+
+typedef struct _render_graph render_graph;
+typedef struct _shader_buffer shader_buffer;
+
+// One watched file; buf is NULL for the shared shader, which every buffer
+// includes
+struct _shader_watch_entry {
+  int wd;
+  char *name;
+  shader_buffer *buf;
+};
+
+typedef struct _shader_watch_entry shader_watch_entry;
+
+// Watches the directory of every shader file, so edits that replace the file
+// (write to a temporary name, then rename) are seen as well
+struct _shader_watch {
+  int fd;
+  shader_watch_entry *entries;
+  int entry_count;
+};
+
+typedef struct _shader_watch shader_watch;
+
+shader_watch *shader_watch_create(render_graph *graph,
+                                  const char *shared_shader_path);
+bool shader_watch_read(shader_watch *watch, bool *changed, int pass_count);
+void shader_watch_free(shader_watch *watch);
+
+#endif
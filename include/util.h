@@ -1,16 +1,41 @@
 #ifndef H_UTIL
 #define H_UTIL
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
 char *load_file(const char *path);
 
 double timespec_to_sec(struct timespec ts);
 
+// Shader clock, which a fixed-step run can pin with set_fixed_time
 struct timespec current_time();
 
+void set_fixed_time(struct timespec time);
+
+bool clock_is_fixed();
+
 double current_time_in_sec();
 
 double time_elapsed(struct timespec start_time);
 
+int64_t timespec_to_ns(struct timespec ts);
+
+struct timespec ns_to_timespec(int64_t ns);
+
+// Always real CLOCK_MONOTONIC time, for scheduling and measurements
+int64_t current_time_in_ns();
+
+// Returns the wlsbg cache directory ($XDG_CACHE_HOME/wlsbg or
+// ~/.cache/wlsbg), creating it if needed. The caller frees the result.
+char *cache_dir();
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size);
+
+uint64_t hash_string(uint64_t hash, const char *str);
+
 #endif
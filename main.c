@@ -1,5 +1,10 @@
+#include "frame_stats.h"
+#include "gpu_timer.h"
+#include "image_file.h"
+#include "render_graph.h"
 #include "resource_registry.h"
 #include "shader.h"
+#include "shader_audio.h"
 #include "shader_channel.h"
 #include "shader_uniform.h"
 #include "util.h"
@@ -9,9 +14,14 @@
 #include <getopt.h>
 #include <linux/input-event-codes.h>
 #include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -23,9 +33,21 @@
   "  -h,     --help                   Show help message and quit.\n"            \
   "  -v,     --version                Show the version number and quit.\n"      \
   "  -f,     --fps <number>           Max FPS limit of the shader.\n"           \
+  "  -d,     --divisor <number>       Render every Nth output refresh.\n"       \
   "  -x,     --scale <number>         Set the resolution scale.\n"              \
   "  -l,     --layer <layer>          Set the layer to display on.\n"           \
   "  -s,     --shared-shader <path>   Set the shared shader file.\n"            \
+  "  -g,     --dump-graph             Print the compiled render graph.\n"       \
+  "  -p,     --profile <seconds>      Report GPU time per pass periodically.\n" \
+  "  -S,     --stats-file <path>      Append SIGUSR1 stats dumps to a file.\n"  \
+  "  -H,     --headless <WxH>         Render offscreen with no compositor.\n"   \
+  "  -n,     --frames <count>         Frames to render in headless mode.\n"     \
+  "  -t,     --time-step <seconds>    Advance the clock by a fixed step.\n"     \
+  "  -j,     --bench-json <path>      Write headless results as JSON.\n"        \
+  "  -o,     --output <path>          Save the last headless frame.\n"          \
+  "  -c,     --compare <path>         Compare the last headless frame.\n"       \
+  "  -T,     --tolerance <number>     Per-channel difference for --compare.\n"  \
+  "  -m,     --mute                   Analyze audio without playing it.\n"      \
   "  -[0-9], --channel[0-9] <path>    Set the resource for a channel.\n"        \
   "\n"                                                                          \
 	"Required Arguments:\n"																											  \
@@ -40,18 +62,37 @@
   "	- `v:<path>`: Load video file\n"                                            \
   "	- `a:<path>`: Load audio file\n"                                            \
   "	- `(resources...)`: Nested buffer definitions\n"                            \
-  "	- `<T>Name:<path>`: Named resources, parsed from left to right\n"
+  "	- `<T>Name:<path>`: Named resources, parsed from left to right\n"          \
+  "	- `<T>Name[key=value,...]:<path>`: Resource options, e.g. b[scale=0.5]\n"
 // clang-format on
 
 #define DEFAULT_FPS 60
+// Loose enough for the rounding differences between drivers, so a reference
+// rendered on one GPU still matches on another
+#define DEFAULT_TOLERANCE 8
+// Reported by headless mode when EGL cannot render offscreen on this host,
+// which test harnesses such as meson count as a skip
+#define EXIT_SKIP 77
 
 static const struct option options[] = {
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'v'},
     {"fps", required_argument, NULL, 'f'},
+    {"divisor", required_argument, NULL, 'd'},
     {"scale", required_argument, NULL, 'x'},
     {"layer", required_argument, NULL, 'l'},
     {"shared-shader", required_argument, NULL, 's'},
+    {"dump-graph", no_argument, NULL, 'g'},
+    {"profile", required_argument, NULL, 'p'},
+    {"stats-file", required_argument, NULL, 'S'},
+    {"headless", required_argument, NULL, 'H'},
+    {"frames", required_argument, NULL, 'n'},
+    {"time-step", required_argument, NULL, 't'},
+    {"bench-json", required_argument, NULL, 'j'},
+    {"output", required_argument, NULL, 'o'},
+    {"compare", required_argument, NULL, 'c'},
+    {"tolerance", required_argument, NULL, 'T'},
+    {"mute", no_argument, NULL, 'm'},
     {"channel0", required_argument, NULL, '0'},
     {"channel1", required_argument, NULL, '1'},
     {"channel2", required_argument, NULL, '2'},
@@ -78,11 +119,34 @@ struct state {
   char *output_name;
   char *shader_path;
   char *shared_shader_path;
-  float fps;
+  bool dump_graph;
+  float profile_interval; // Seconds between GPU time reports, 0 for none
+  char *stats_file;       // Where SIGUSR1 dumps go, stderr if NULL
+
+  // Offscreen rendering with no Wayland connection
+  bool headless;
+  int headless_width, headless_height;
+  int frames;       // Frames to render before exiting
+  double time_step; // Seconds the clock advances per frame, 0 for real time
+  char *bench_json; // Where to write the results of a headless run
+  char *output;     // Last frame as PNG (.png) or raw RGBA
+  char *compare;    // Reference image the last frame must match
+  int tolerance;    // Largest allowed per-channel difference
+  float fps;   // Frame rate cap, 0 to follow the output refresh rate
+  int divisor; // Render every Nth refresh of the output
   float scale;
   enum zwlr_layer_shell_v1_layer layer;
   struct timespec start_time;
 
+  // GPU context shared by all outputs
+  shader_context *shader_ctx;
+
+  // Frame scheduling
+  int timer_fd;
+  int signal_fd;          // SIGUSR1 stats dump requests
+  int64_t armed_deadline; // Absolute CLOCK_MONOTONIC time the timer is set to
+  int64_t next_report;    // When the next GPU time report is due
+
   char *channel_input[10];
 
   // Track mouse positions
@@ -104,7 +168,7 @@ struct output {
 
   struct zwlr_layer_surface_v1 *layer_surface;
   struct wl_surface *surface;
-  shader_context *shader_ctx;
+  shader_surface *shader_surface;
 
   struct wp_viewport *viewport;
   int width, height;
@@ -113,6 +177,12 @@ struct output {
   bool needs_resize;
   uint32_t last_serial;
   struct wl_callback *frame_callback;
+
+  int32_t refresh;        // Current mode refresh rate in mHz, 0 if unknown
+  int64_t frame_interval; // Nanoseconds between frames on this output
+  int64_t next_frame;     // Absolute CLOCK_MONOTONIC deadline in nanoseconds
+  bool frame_due;         // Deadline passed, waiting for the frame callback
+  int64_t missed_frames;  // Deadlines skipped before the due frame
 };
 
 static void destroy_output(struct output *output) {
@@ -123,8 +193,8 @@ static void destroy_output(struct output *output) {
     wl_callback_destroy(output->frame_callback);
   if (output->viewport)
     wp_viewport_destroy(output->viewport);
-  if (output->shader_ctx)
-    shader_destroy(output->shader_ctx);
+  if (output->shader_surface)
+    shader_surface_destroy(output->shader_surface);
   if (output->surface)
     wl_surface_destroy(output->surface);
   if (output->layer_surface)
@@ -147,7 +217,7 @@ static void frame_done(void *data, struct wl_callback *wl_callback,
   }
   /* clearing frame callback field indicates output is ready for drawing.
    * Note that this callback will interrupt the call to poll in the main
-   * loop.
+   * loop, so an output that is already due renders right away.
    */
   wl_callback_destroy(wl_callback);
   output->frame_callback = NULL;
@@ -174,14 +244,13 @@ static void layer_surface_configure(void *data,
   if (height > 0)
     output->height = height;
 
-  if (!output->shader_ctx) {
-    // First configure: create shader context
-    output->shader_ctx =
-        shader_create(state->display, output->surface, state->shader_path,
-                      state->shared_shader_path, output->width * output->scale,
-                      output->height * output->scale, state->channel_input);
-    if (!output->shader_ctx) {
-      fprintf(stderr, "Failed to create shader context\n");
+  if (!output->shader_surface) {
+    // First configure: create this output's surface on the shared context
+    output->shader_surface = shader_surface_create(
+        state->shader_ctx, output->surface, output->width * output->scale,
+        output->height * output->scale);
+    if (!output->shader_surface) {
+      fprintf(stderr, "Failed to create shader surface\n");
       exit(EXIT_FAILURE);
     }
 
@@ -194,7 +263,7 @@ static void layer_surface_configure(void *data,
     // If the keyboard resource was referenced
     // enable keyboard input for this output
     resource_registry *keyboard_registry =
-        registry_lookup(output->shader_ctx->registry, "Keyboard", TEXTURE);
+        registry_lookup(state->shader_ctx->registry, "Keyboard", TEXTURE);
     if (keyboard_registry->referenced) {
       zwlr_layer_surface_v1_set_keyboard_interactivity(
           output->layer_surface,
@@ -203,14 +272,15 @@ static void layer_surface_configure(void *data,
 
     zwlr_layer_surface_v1_ack_configure(surface, serial);
 
-    // First draw
-    shader_render(output->shader_ctx, current_time(), NULL);
-
-    // Setup frame callback (rendering happens later)
+    // Setup frame callback before the first commit (rendering happens later)
     output->frame_callback = wl_surface_frame(output->surface);
     wl_callback_add_listener(output->frame_callback, &frame_callback_listener,
                              output);
 
+    // First draw
+    shader_render(output->shader_surface, current_time(), NULL);
+    output->next_frame = current_time_in_ns() + output->frame_interval;
+
     output->needs_resize = false; // Already created with correct size
   } else {
     // Always set ACK flag for every configure
@@ -243,13 +313,28 @@ static void output_geometry(void *data, struct wl_output *wl_output, int32_t x,
 
 static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags,
                         int32_t width, int32_t height, int32_t refresh) {
-  // Unused
+  struct output *output = data;
+  if (output && (flags & WL_OUTPUT_MODE_CURRENT))
+    output->refresh = refresh;
+}
+
+// Derive the frame interval from the panel refresh, then apply the divisor
+// and the optional fps cap
+static void update_frame_interval(struct output *output) {
+  struct state *state = output->state;
+  double refresh = output->refresh > 0 ? output->refresh / 1000.0 : DEFAULT_FPS;
+  double fps = refresh / state->divisor;
+  if (state->fps > 0 && fps > state->fps)
+    fps = state->fps;
+  output->frame_interval = (int64_t)(1e9 / fps);
 }
 
 static void output_done(void *data, struct wl_output *wl_output) {
   struct output *output = data;
   if (!output)
     return;
+  // Mode changes are followed by done, so this keeps the pacing current
+  update_frame_interval(output);
   if (output->surface) {
     /* output has already been given a surface */
     return;
@@ -418,16 +503,13 @@ static void keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
                                 uint32_t serial, uint32_t time, uint32_t key,
                                 uint32_t key_state) {
   struct state *state = data;
-  if (!state)
+  if (!state || !state->shader_ctx)
     return;
 
-  struct output *output, *tmp;
-  wl_list_for_each_safe(output, tmp, &state->outputs, link) {
-    // Update key state (key is the scancode)
-    bool is_pressed = (key_state == WL_KEYBOARD_KEY_STATE_PRESSED);
-    if (key < 256) {
-      output->shader_ctx->keyboard.key[key] = is_pressed;
-    }
+  // Update key state (key is the scancode)
+  bool is_pressed = (key_state == WL_KEYBOARD_KEY_STATE_PRESSED);
+  if (key < 256) {
+    state->shader_ctx->keyboard.key[key] = is_pressed;
   }
 }
 
@@ -547,17 +629,326 @@ static const struct wl_registry_listener registry_listener = {
 
 // }}>
 
+// <{{ Frame scheduling
+
+// Arm the timer for the earliest deadline of any output not already due.
+// Outputs that are due wait on their frame callback, not on the timer.
+static void arm_frame_timer(struct state *state) {
+  int64_t deadline = 0;
+  struct output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (!output->shader_surface || output->frame_due)
+      continue;
+    if (deadline == 0 || output->next_frame < deadline)
+      deadline = output->next_frame;
+  }
+
+  if (deadline == state->armed_deadline)
+    return;
+  state->armed_deadline = deadline;
+
+  // A zero it_value disarms the timer
+  struct itimerspec spec = {0};
+  if (deadline > 0)
+    spec.it_value = ns_to_timespec(deadline);
+  timerfd_settime(state->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+// Mark outputs whose deadline passed as due, skipping any frames missed
+// during a stall instead of replaying them
+static void update_frame_deadlines(struct state *state) {
+  int64_t now = current_time_in_ns();
+  struct output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    if (!output->shader_surface || output->frame_due ||
+        now < output->next_frame)
+      continue;
+    output->frame_due = true;
+    int64_t missed = (now - output->next_frame) / output->frame_interval;
+    output->next_frame += (missed + 1) * output->frame_interval;
+    output->missed_frames += missed;
+  }
+}
+
+static void render_output(struct state *state, struct output *output) {
+  // Handle pending resize
+  if (output->needs_resize) {
+    shader_surface_resize(output->shader_surface,
+                          output->width * output->scale,
+                          output->height * output->scale);
+    output->needs_resize = false;
+  }
+
+  // Handle pending configure ack
+  if (output->needs_ack) {
+    zwlr_layer_surface_v1_ack_configure(output->layer_surface,
+                                        output->last_serial);
+    output->needs_ack = false;
+  }
+
+  // Create iMouse struct for uniform
+  float scale_x = (float)(output->width * output->scale) / output->width;
+  float scale_y = (float)(output->height * output->scale) / output->height;
+  iMouse mouse = {.real_x = state->mouse.x * scale_x,
+                  .real_y = (output->height - state->mouse.y) * scale_y,
+                  .x = state->mouse.down_x * scale_x,
+                  .y = (output->height - state->mouse.down_y) * scale_y,
+                  .z = state->mouse.is_down ? state->mouse.click_x * scale_x
+                                            : -state->mouse.click_x * scale_x,
+                  .w = state->mouse.is_clicked
+                           ? (output->height - state->mouse.click_y) * scale_y
+                           : -(output->height - state->mouse.click_y) *
+                                 scale_y};
+  // Mouse click should only be for 1 frame
+  state->mouse.is_clicked = false;
+
+  // Setup frame callback before the commit in eglSwapBuffers
+  output->frame_callback = wl_surface_frame(output->surface);
+  wl_callback_add_listener(output->frame_callback, &frame_callback_listener,
+                           output);
+
+  int64_t render_start = current_time_in_ns();
+  shader_render(output->shader_surface, state->start_time, &mouse);
+  frame_stats_add(STAT_RENDER, current_time_in_ns() - render_start);
+  frame_stats_frame(output->missed_frames);
+  output->missed_frames = 0;
+  output->frame_due = false;
+}
+
+static void report_profile(struct state *state, FILE *out) {
+  shader_report_profile(state->shader_ctx, out);
+  struct output *output;
+  wl_list_for_each(output, &state->outputs, link) {
+    shader_surface_report_profile(output->shader_surface, output->name, out);
+  }
+}
+
+// Written between frames, so a dump never interrupts rendering midway
+static void dump_stats(struct state *state) {
+  FILE *out = stderr;
+  if (state->stats_file) {
+    out = fopen(state->stats_file, "a");
+    if (!out) {
+      fprintf(stderr, "Failed to open stats file '%s'\n", state->stats_file);
+      return;
+    }
+  }
+
+  frame_stats_dump(out);
+  if (state->profile_interval > 0)
+    report_profile(state, out);
+
+  if (out != stderr)
+    fclose(out);
+}
+
+// Render every output that is due and whose previous frame was presented
+static bool render_due_outputs(struct state *state) {
+  bool updated = false;
+  struct output *output, *tmp;
+  wl_list_for_each_safe(output, tmp, &state->outputs, link) {
+    if (!output->shader_surface || !output->frame_due ||
+        output->frame_callback)
+      continue;
+
+    // Advance shared resources once for this frame
+    if (!updated) {
+      if (!shader_update(state->shader_ctx, state->start_time))
+        return false;
+      updated = true;
+    }
+
+    render_output(state, output);
+  }
+  return true;
+}
+
+// }}>
+
+// <{{ Headless rendering
+
+static void write_json_string(FILE *out, const char *str) {
+  fputc('"', out);
+  for (const char *c = str; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(out, "\\%c", *c);
+    else if ((unsigned char)*c < 0x20)
+      fprintf(out, "\\u%04x", *c);
+    else
+      fputc(*c, out);
+  }
+  fputc('"', out);
+}
+
+static void write_json_timers(FILE *out, gpu_timer **timers, int count) {
+  fprintf(out, "[");
+  for (int i = 0; i < count; i++) {
+    gpu_timer_summary summary = {0};
+    gpu_timer_summarize(timers[i], &summary);
+    fprintf(out, "%s\n    {\"label\": ", i > 0 ? "," : "");
+    write_json_string(out, timers[i] ? timers[i]->label : "");
+    fprintf(out,
+            ", \"mean_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, "
+            "\"samples\": %d}",
+            summary.mean, summary.p95, summary.p99, summary.samples);
+  }
+  fprintf(out, count > 0 ? "\n  ]" : "]");
+}
+
+// One JSON object per run, so results can be compared between releases
+// gpu_memory is -1 when the driver cannot report it
+static bool write_bench_json(struct state *state, shader_surface *surface,
+                             bool profiling, double seconds,
+                             int64_t gpu_memory) {
+  FILE *out = fopen(state->bench_json, "w");
+  if (!out) {
+    fprintf(stderr, "Failed to open '%s' for writing\n", state->bench_json);
+    return false;
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  shader_context *ctx = state->shader_ctx;
+  fprintf(out, "{\n  \"version\": ");
+  write_json_string(out, WLSBG_VERSION);
+  fprintf(out, ",\n  \"shader\": ");
+  write_json_string(out, state->shader_path);
+  fprintf(out,
+          ",\n  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n"
+          "  \"time_step\": %g,\n  \"seconds\": %.6f,\n  \"fps\": %.3f,\n"
+          "  \"peak_rss_kib\": %ld,\n  \"gpu_memory_kib\": ",
+          state->headless_width, state->headless_height, state->frames,
+          state->time_step, seconds, state->frames / seconds,
+          usage.ru_maxrss);
+  // Process RSS leaves out video memory, so that is reported separately
+  if (gpu_memory >= 0)
+    fprintf(out, "%lld", (long long)gpu_memory);
+  else
+    fprintf(out, "null");
+  fprintf(out, ",\n  \"gpu_timing\": %s,\n  \"passes\": ",
+          profiling ? "true" : "false");
+  write_json_timers(out, surface->pass_timers,
+                    surface->pass_timers ? ctx->graph->pass_count : 0);
+  fprintf(out, ",\n  \"video\": ");
+  write_json_timers(out, ctx->video_timers, ctx->video_timer_count);
+  fprintf(out, "\n}\n");
+
+  return fclose(out) == 0;
+}
+
+// Saves and/or compares the last rendered frame
+static bool check_last_frame(struct state *state, shader_surface *surface) {
+  int width = state->headless_width, height = state->headless_height;
+  unsigned char *rgba = malloc((size_t)width * height * 4);
+  if (!rgba)
+    return false;
+
+  bool ok = shader_surface_read_pixels(surface, rgba);
+  if (!ok)
+    fprintf(stderr, "Failed to read back the rendered frame\n");
+  if (ok && state->output)
+    ok = write_image(state->output, rgba, width, height);
+  if (ok && state->compare)
+    ok = compare_image(state->compare, rgba, width, height, state->tolerance);
+
+  free(rgba);
+  return ok;
+}
+
+// Renders a fixed number of frames offscreen and exits, for benchmarking and
+// testing without a compositor or GPU
+static int run_headless(struct state *state) {
+  // Pinned before any resource is created, so media starts in stepped mode
+  if (state->time_step > 0)
+    set_fixed_time(state->start_time);
+
+  bool unavailable;
+  state->shader_ctx =
+      shader_create_headless(state->shader_path, state->shared_shader_path,
+                             state->channel_input, &unavailable);
+  if (!state->shader_ctx) {
+    fprintf(stderr, "Failed to create headless shader context\n");
+    return unavailable ? EXIT_SKIP : EXIT_FAILURE;
+  }
+  shader_context *ctx = state->shader_ctx;
+
+  if (state->dump_graph)
+    render_graph_dump(ctx->graph, stderr);
+  bool profiling = (state->profile_interval > 0 || state->bench_json) &&
+                   shader_enable_profiling(ctx);
+
+  int status = EXIT_FAILURE;
+  // Sampled around the run, so the difference covers the render targets
+  int64_t free_before = shader_free_video_memory(ctx);
+  shader_surface *surface = shader_surface_create_offscreen(
+      ctx, state->headless_width, state->headless_height);
+  if (!surface || !shader_wait_ready(ctx))
+    goto done;
+
+  iMouse mouse = {0};
+  int64_t start = current_time_in_ns();
+  int64_t clock_start = timespec_to_ns(state->start_time);
+  for (int i = 0; i < state->frames; i++) {
+    if (state->time_step > 0)
+      set_fixed_time(
+          ns_to_timespec(clock_start + (int64_t)(i * state->time_step * 1e9)));
+
+    if (!shader_update(ctx, state->start_time))
+      goto done;
+
+    int64_t render_start = current_time_in_ns();
+    shader_render(surface, state->start_time, &mouse);
+    frame_stats_add(STAT_RENDER, current_time_in_ns() - render_start);
+    frame_stats_frame(0);
+  }
+  shader_finish(ctx);
+  double seconds = (current_time_in_ns() - start) / 1e9;
+  shader_surface_collect_profile(surface);
+  int64_t free_after = shader_free_video_memory(ctx);
+  int64_t gpu_memory = -1;
+  if (free_before >= 0 && free_after >= 0)
+    gpu_memory = free_before > free_after ? free_before - free_after : 0;
+
+  fprintf(stderr, "Rendered %d frames at %dx%d in %.3f s (%.1f fps)\n",
+          state->frames, state->headless_width, state->headless_height,
+          seconds, state->frames / seconds);
+  if (profiling && state->profile_interval > 0) {
+    shader_report_profile(ctx, stderr);
+    shader_surface_report_profile(surface, "headless", stderr);
+  }
+  if (state->bench_json &&
+      !write_bench_json(state, surface, profiling, seconds, gpu_memory))
+    goto done;
+  if ((state->output || state->compare) && !check_last_frame(state, surface))
+    goto done;
+  status = EXIT_SUCCESS;
+
+done:
+  shader_surface_destroy(surface);
+  shader_destroy(ctx);
+  return status;
+}
+
+// }}>
+
 int main(int argc, char *argv[]) {
   struct state state = {0};
-  state.fps = DEFAULT_FPS;
+  int status = EXIT_SUCCESS;
+  state.divisor = 1;
   state.scale = 1;
   state.layer = ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND;
+  state.timer_fd = -1;
+  state.signal_fd = -1;
+  state.frames = 1;
+  state.tolerance = DEFAULT_TOLERANCE;
   wl_list_init(&state.outputs);
   clock_gettime(CLOCK_MONOTONIC, &state.start_time);
 
   // Parse command line
   int opt;
-  while ((opt = getopt_long(argc, argv, "hvf:x:l:s:0:1:2:3:4:5:6:7:8:9:",
+  const char *headless_option = NULL; // Last option that needs --headless
+  while ((opt = getopt_long(argc, argv, "hvf:d:x:l:s:gp:S:H:n:t:j:o:c:T:m0:1:2:3:4:5:6:7:8:9:",
                             options, NULL)) != -1) {
     switch (opt) {
     case 'h':
@@ -569,8 +960,17 @@ int main(int argc, char *argv[]) {
     case 'f':
       state.fps = atof(optarg);
       if (state.fps <= 0) {
-        state.fps = DEFAULT_FPS;
-        fprintf(stderr, "FPS must be a valid number >0, defaulting to 60fps\n");
+        state.fps = 0;
+        fprintf(stderr, "FPS must be a valid number >0, defaulting to the "
+                        "output refresh rate\n");
+      }
+      break;
+    case 'd':
+      state.divisor = atoi(optarg);
+      if (state.divisor <= 0) {
+        state.divisor = 1;
+        fprintf(stderr, "Divisor must be a valid integer >0, defaulting to "
+                        "every refresh\n");
       }
       break;
     case 'x':
@@ -596,6 +996,72 @@ int main(int argc, char *argv[]) {
     case 's':
       state.shared_shader_path = optarg;
       break;
+    case 'g':
+      state.dump_graph = true;
+      break;
+    case 'p':
+      state.profile_interval = atof(optarg);
+      if (state.profile_interval <= 0) {
+        state.profile_interval = 0;
+        fprintf(stderr, "Profile interval must be a valid number >0, "
+                        "profiling disabled\n");
+      }
+      break;
+    case 'S':
+      state.stats_file = optarg;
+      break;
+    case 'H':
+      if (sscanf(optarg, "%dx%d", &state.headless_width,
+                 &state.headless_height) != 2 ||
+          state.headless_width <= 0 || state.headless_height <= 0) {
+        fprintf(stderr, "Headless size must be given as WIDTHxHEIGHT\n");
+        return EXIT_FAILURE;
+      }
+      state.headless = true;
+      break;
+    case 'n':
+      headless_option = "--frames";
+      state.frames = atoi(optarg);
+      if (state.frames <= 0) {
+        state.frames = 1;
+        fprintf(stderr, "Frame count must be a valid integer >0, defaulting "
+                        "to 1\n");
+      }
+      break;
+    case 't':
+      headless_option = "--time-step";
+      state.time_step = atof(optarg);
+      if (state.time_step <= 0) {
+        state.time_step = 0;
+        fprintf(stderr, "Time step must be a valid number >0, using the real "
+                        "clock\n");
+      }
+      break;
+    case 'j':
+      headless_option = "--bench-json";
+      state.bench_json = optarg;
+      break;
+    case 'o':
+      headless_option = "--output";
+      state.output = optarg;
+      break;
+    case 'c':
+      headless_option = "--compare";
+      state.compare = optarg;
+      break;
+    case 'T':
+      headless_option = "--tolerance";
+      state.tolerance = atoi(optarg);
+      if (state.tolerance < 0) {
+        state.tolerance = DEFAULT_TOLERANCE;
+        fprintf(stderr, "Tolerance must be a valid integer >=0, defaulting to "
+                        "%d\n",
+                DEFAULT_TOLERANCE);
+      }
+      break;
+    case 'm':
+      shader_audio_set_muted(true);
+      break;
     case '0':
     case '1':
     case '2':
@@ -616,6 +1082,25 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // Only headless runs end with a frame to save or compare, so these would
+  // otherwise be silently ignored
+  if (!state.headless && headless_option) {
+    fprintf(stderr, "%s requires --headless\n", headless_option);
+    fprintf(stderr, USAGE_STRING);
+    return EXIT_FAILURE;
+  }
+
+  // Without outputs the shader is the only positional argument
+  if (state.headless) {
+    if (argc - optind != 1) {
+      fprintf(stderr, "Headless mode takes only SHADER.frag, no OUTPUT\n");
+      fprintf(stderr, USAGE_STRING);
+      return EXIT_FAILURE;
+    }
+    state.shader_path = argv[optind];
+    return run_headless(&state);
+  }
+
   if (argc - optind < 2) {
     fprintf(stderr, USAGE_STRING);
     return EXIT_FAILURE;
@@ -624,6 +1109,14 @@ int main(int argc, char *argv[]) {
   state.output_name = argv[optind];
   state.shader_path = argv[optind + 1];
 
+  // Stats dumps are read from a signalfd in the main loop. The signal is
+  // blocked before any audio or video thread starts, so none of them takes
+  // it instead.
+  sigset_t stats_signals;
+  sigemptyset(&stats_signals);
+  sigaddset(&stats_signals, SIGUSR1);
+  sigprocmask(SIG_BLOCK, &stats_signals, NULL);
+
   // Connect to Wayland
   state.display = wl_display_connect(NULL);
   if (!state.display) {
@@ -655,107 +1148,131 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  // Create the GPU context and load every resource once for all outputs
+  state.shader_ctx =
+      shader_create(state.display, state.shader_path, state.shared_shader_path,
+                    state.channel_input);
+  if (!state.shader_ctx) {
+    fprintf(stderr, "Failed to create shader context\n");
+    wl_registry_destroy(state.registry);
+    wl_display_disconnect(state.display);
+    return EXIT_FAILURE;
+  }
+
+  if (state.dump_graph)
+    render_graph_dump(state.shader_ctx->graph, stderr);
+
+  // Timers are allocated per output, so this comes before any is configured
+  if (state.profile_interval > 0) {
+    if (shader_enable_profiling(state.shader_ctx))
+      state.next_report =
+          current_time_in_ns() + (int64_t)(state.profile_interval * 1e9);
+    else
+      state.profile_interval = 0;
+  }
+
   // Main loop
-  int display_fd = wl_display_get_fd(state.display);
-  double frame_time = 1.0 / state.fps;
-  struct timespec next_frame = state.start_time;
+  state.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (state.timer_fd < 0) {
+    perror("timerfd_create failed");
+    goto cleanup;
+  }
+  state.signal_fd = signalfd(-1, &stats_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (state.signal_fd < 0) {
+    perror("signalfd failed");
+    goto cleanup;
+  }
+
+  // A negative fd (no shader watch) is ignored by poll
+  struct pollfd pfds[] = {
+      {wl_display_get_fd(state.display), POLLIN, 0},
+      {state.timer_fd, POLLIN, 0},
+      {shader_watch_fd(state.shader_ctx), POLLIN, 0},
+      {state.signal_fd, POLLIN, 0},
+  };
 
   while (true) {
-    if (wl_display_dispatch_pending(state.display) == -1) {
-      fprintf(stderr, "Failed to dispatch events\n");
-      break;
+    // Drain queued events before blocking
+    while (wl_display_prepare_read(state.display) != 0) {
+      if (wl_display_dispatch_pending(state.display) == -1) {
+        fprintf(stderr, "Failed to dispatch events\n");
+        goto cleanup;
+      }
     }
     if (wl_display_flush(state.display) == -1 && errno != EAGAIN) {
       fprintf(stderr, "Failed to flush\n");
+      wl_display_cancel_read(state.display);
       break;
     }
 
-    // Calculate time until next frame
-    double sec_until_next = timespec_to_sec(next_frame) - current_time_in_sec();
-    int timeout_ms = sec_until_next > 0 ? (int)(sec_until_next * 1000) : 0;
-
-    // Poll for events
-    struct pollfd pfd = {display_fd, POLLIN, 0};
-    int poll_result = poll(&pfd, 1, timeout_ms);
-
+    // Sleep until the next output deadline, a Wayland event or a stats request
+    arm_frame_timer(&state);
+    int poll_result = poll(pfds, 4, -1);
     if (poll_result < 0 && errno != EINTR) {
       perror("poll failed");
+      wl_display_cancel_read(state.display);
       break;
     }
 
-    if (pfd.revents & POLLIN) {
-      if (wl_display_prepare_read(state.display) == -1) {
-        fprintf(stderr, "Failed to prepare read\n");
-        break;
-      }
+    int64_t dispatch_start = current_time_in_ns();
+    if (poll_result > 0 && (pfds[0].revents & POLLIN)) {
       if (wl_display_read_events(state.display) == -1) {
         fprintf(stderr, "Failed to read events\n");
         break;
       }
+    } else {
+      wl_display_cancel_read(state.display);
+    }
+    // Frame callbacks arriving here may unblock due outputs
+    if (wl_display_dispatch_pending(state.display) == -1) {
+      fprintf(stderr, "Failed to dispatch events\n");
+      break;
+    }
+    frame_stats_add(STAT_DISPATCH, current_time_in_ns() - dispatch_start);
+
+    // Requests queued since the last wakeup share one dump
+    if (poll_result > 0 && (pfds[3].revents & POLLIN)) {
+      struct signalfd_siginfo info;
+      while (read(state.signal_fd, &info, sizeof(info)) == sizeof(info))
+        ;
+      dump_stats(&state);
     }
 
-    // Render if it's time
-    if (current_time_in_sec() >= timespec_to_sec(next_frame)) {
-      // Update next frame time
-      next_frame.tv_nsec += (long)(frame_time * 1e9);
-      if (next_frame.tv_nsec >= 1e9) {
-        next_frame.tv_nsec -= 1e9;
-        next_frame.tv_sec++;
-      }
+    if (poll_result > 0 && (pfds[1].revents & POLLIN)) {
+      uint64_t expirations;
+      read(state.timer_fd, &expirations, sizeof(expirations));
+    }
 
-      // Render all outputs
-      struct output *output, *tmp;
-      wl_list_for_each_safe(output, tmp, &state.outputs, link) {
-        if (!output->shader_ctx || output->frame_callback)
-          continue;
-
-        // Handle pending resize
-        if (output->needs_resize) {
-          shader_resize(output->shader_ctx, output->width * output->scale,
-                        output->height * output->scale);
-          output->needs_resize = false;
-        }
-
-        // Handle pending configure ack
-        if (output->needs_ack) {
-          zwlr_layer_surface_v1_ack_configure(output->layer_surface,
-                                              output->last_serial);
-          output->needs_ack = false;
-        }
-
-        // Create iMouse struct for uniform
-        float scale_x = (float)(output->width * output->scale) / output->width;
-        float scale_y =
-            (float)(output->height * output->scale) / output->height;
-        iMouse mouse = {
-            .real_x = state.mouse.x * scale_x,
-            .real_y = (output->height - state.mouse.y) * scale_y,
-            .x = state.mouse.down_x * scale_x,
-            .y = (output->height - state.mouse.down_y) * scale_y,
-            .z = state.mouse.is_down ? state.mouse.click_x * scale_x
-                                     : -state.mouse.click_x * scale_x,
-            .w = state.mouse.is_clicked
-                     ? (output->height - state.mouse.click_y) * scale_y
-                     : -(output->height - state.mouse.click_y) * scale_y};
-        // Mouse click should only be for 1 frame
-        state.mouse.is_clicked = false;
-
-        shader_render(output->shader_ctx, state.start_time, &mouse);
-
-        // Setup frame callback
-        output->frame_callback = wl_surface_frame(output->surface);
-        wl_callback_add_listener(output->frame_callback,
-                                 &frame_callback_listener, output);
-      }
+    if (poll_result > 0 && (pfds[2].revents & POLLIN))
+      shader_reload(state.shader_ctx);
+
+    update_frame_deadlines(&state);
+    if (!render_due_outputs(&state)) {
+      status = EXIT_FAILURE;
+      break;
+    }
+
+    if (state.profile_interval > 0 &&
+        current_time_in_ns() >= state.next_report) {
+      report_profile(&state, stderr);
+      state.next_report += (int64_t)(state.profile_interval * 1e9);
     }
   }
 
+cleanup:
+  if (state.timer_fd >= 0)
+    close(state.timer_fd);
+  if (state.signal_fd >= 0)
+    close(state.signal_fd);
+
   // Cleanup outputs
   struct output *output, *tmp;
   wl_list_for_each_safe(output, tmp, &state.outputs, link) {
     destroy_output(output);
   }
 
+  shader_destroy(state.shader_ctx);
+
   if (state.wl_keyboard)
     wl_keyboard_release(state.wl_keyboard);
   if (state.pointer)
@@ -773,5 +1290,5 @@ int main(int argc, char *argv[]) {
   if (state.display)
     wl_display_disconnect(state.display);
 
-  return EXIT_SUCCESS;
+  return status;
 }
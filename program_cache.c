@@ -0,0 +1,249 @@
+#include "program_cache.h"
+#include "util.h"
+#include <GLES3/gl3.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PROGRAM_CACHE_MAGIC "WLSBGPB1"
+#define PROGRAM_CACHE_MAX_SIZE (64 * 1024 * 1024)
+// Every edit of a shader stores a new binary, so the oldest are evicted once
+// the cache holds more than this many entries or bytes
+#define PROGRAM_CACHE_MAX_ENTRIES 256
+#define PROGRAM_CACHE_MAX_BYTES (256 * 1024 * 1024)
+
+struct _program_cache_header {
+  char magic[8];
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+};
+
+typedef struct _program_cache_header program_cache_header;
+
+static bool binaries_supported() {
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0;
+}
+
+static char *cache_path(uint64_t key) {
+  char *dir = cache_dir();
+  if (!dir)
+    return NULL;
+
+  size_t size = strlen(dir) + 32;
+  char *path = malloc(size);
+  if (path)
+    snprintf(path, size, "%s/%016llx.bin", dir, (unsigned long long)key);
+  free(dir);
+  return path;
+}
+
+struct _cache_entry {
+  char name[32];
+  struct timespec mtime; // Last use, see program_cache_load
+  off_t size;
+};
+
+typedef struct _cache_entry cache_entry;
+
+static int compare_entry_age(const void *a, const void *b) {
+  const struct timespec *ta = &((const cache_entry *)a)->mtime;
+  const struct timespec *tb = &((const cache_entry *)b)->mtime;
+  if (ta->tv_sec != tb->tv_sec)
+    return ta->tv_sec < tb->tv_sec ? -1 : 1;
+  if (ta->tv_nsec != tb->tv_nsec)
+    return ta->tv_nsec < tb->tv_nsec ? -1 : 1;
+  return 0;
+}
+
+// Only files named like cache_path's, leaving temporaries and the FFTW
+// wisdom alone
+static bool is_cache_entry(const char *name) {
+  size_t length = strlen(name);
+  return length == 20 && strcmp(name + 16, ".bin") == 0 &&
+         strspn(name, "0123456789abcdef") == 16;
+}
+
+// Deletes the least recently used binaries until the cache is within
+// PROGRAM_CACHE_MAX_ENTRIES and PROGRAM_CACHE_MAX_BYTES
+static void prune_cache() {
+  char *dir = cache_dir();
+  if (!dir)
+    return;
+  DIR *stream = opendir(dir);
+  if (!stream) {
+    free(dir);
+    return;
+  }
+
+  cache_entry *entries = NULL;
+  size_t count = 0, capacity = 0;
+  off_t total = 0;
+  size_t path_size = strlen(dir) + 32;
+  char *path = malloc(path_size);
+  struct dirent *dirent;
+  while (path && (dirent = readdir(stream))) {
+    if (!is_cache_entry(dirent->d_name))
+      continue;
+
+    struct stat st;
+    snprintf(path, path_size, "%s/%s", dir, dirent->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    if (count == capacity) {
+      size_t new_capacity = capacity ? capacity * 2 : 64;
+      cache_entry *grown = realloc(entries, new_capacity * sizeof(*entries));
+      if (!grown)
+        break;
+      entries = grown;
+      capacity = new_capacity;
+    }
+    cache_entry *entry = &entries[count++];
+    snprintf(entry->name, sizeof(entry->name), "%s", dirent->d_name);
+    entry->mtime = st.st_mtim;
+    entry->size = st.st_size;
+    total += st.st_size;
+  }
+  closedir(stream);
+
+  if (count > PROGRAM_CACHE_MAX_ENTRIES || total > PROGRAM_CACHE_MAX_BYTES) {
+    qsort(entries, count, sizeof(*entries), compare_entry_age);
+    for (size_t i = 0; i < count && (count - i > PROGRAM_CACHE_MAX_ENTRIES ||
+                                     total > PROGRAM_CACHE_MAX_BYTES);
+         i++) {
+      snprintf(path, path_size, "%s/%s", dir, entries[i].name);
+      if (unlink(path) == 0)
+        total -= entries[i].size;
+    }
+  }
+
+  free(entries);
+  free(path);
+  free(dir);
+}
+
+uint64_t program_cache_key(const char *vertex_source,
+                           const char *fragment_source) {
+  uint64_t hash = HASH_SEED;
+  hash = hash_string(hash, PROGRAM_CACHE_MAGIC);
+  hash = hash_string(hash, (const char *)glGetString(GL_VENDOR));
+  hash = hash_string(hash, (const char *)glGetString(GL_RENDERER));
+  hash = hash_string(hash, (const char *)glGetString(GL_VERSION));
+  hash = hash_string(hash, vertex_source);
+  hash = hash_string(hash, fragment_source);
+  return hash;
+}
+
+bool program_cache_load(GLuint *program, uint64_t key) {
+  if (!binaries_supported())
+    return false;
+
+  char *path = cache_path(key);
+  if (!path)
+    return false;
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    free(path);
+    return false;
+  }
+
+  bool loaded = false;
+  void *binary = NULL;
+  program_cache_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1)
+    goto done;
+  if (memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.key != key || header.length == 0 ||
+      header.length > PROGRAM_CACHE_MAX_SIZE)
+    goto done;
+
+  binary = malloc(header.length);
+  if (!binary || fread(binary, header.length, 1, file) != 1)
+    goto done;
+
+  *program = glCreateProgram();
+  if (!*program)
+    goto done;
+
+  glProgramBinary(*program, header.format, binary, header.length);
+
+  // Drivers reject binaries after an update; that is not an error, the
+  // program is simply rebuilt from source
+  GLint success = GL_FALSE;
+  glGetProgramiv(*program, GL_LINK_STATUS, &success);
+  if (success) {
+    loaded = true;
+    // The modification time doubles as the last use for prune_cache
+    utimensat(AT_FDCWD, path, NULL, 0);
+  } else {
+    glDeleteProgram(*program);
+    *program = 0;
+  }
+
+done:
+  fclose(file);
+  free(binary);
+  if (!loaded)
+    unlink(path);
+  free(path);
+  return loaded;
+}
+
+void program_cache_store(GLuint program, uint64_t key) {
+  if (!binaries_supported())
+    return;
+
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0 || length > PROGRAM_CACHE_MAX_SIZE)
+    return;
+
+  void *binary = malloc(length);
+  if (!binary)
+    return;
+
+  program_cache_header header = {.key = key};
+  memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+  GLenum format = 0;
+  GLsizei written = 0;
+  glGetProgramBinary(program, length, &written, &format, binary);
+  header.format = format;
+  header.length = written;
+
+  char *path = cache_path(key);
+  if (written <= 0 || !path) {
+    free(binary);
+    free(path);
+    return;
+  }
+
+  // Write to a temporary file and rename it into place, so a concurrent
+  // instance never reads a half-written binary
+  size_t tmp_size = strlen(path) + 16;
+  char *tmp_path = malloc(tmp_size);
+  if (tmp_path) {
+    snprintf(tmp_path, tmp_size, "%s.%d", path, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    if (file) {
+      bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(binary, written, 1, file) == 1;
+      ok = fclose(file) == 0 && ok;
+      if (!ok || rename(tmp_path, path) != 0)
+        unlink(tmp_path);
+      else
+        prune_cache();
+    }
+    free(tmp_path);
+  }
+
+  free(binary);
+  free(path);
+}
@@ -0,0 +1,169 @@
+#include "render_graph.h"
+#include "shader_audio.h"
+#include "shader_buffer.h"
+#include "shader_channel.h"
+#include "shader_texture.h"
+#include "shader_video.h"
+#include <stdlib.h>
+
+enum visit_state { UNVISITED, ON_STACK, DONE };
+
+struct compile_state {
+  render_graph *graph;
+  shader_buffer **visited; // Every buffer seen so far
+  enum visit_state *state; // Parallel to visited
+  int visited_count;
+  int visited_capacity;
+};
+
+static int find_visited(struct compile_state *cs, shader_buffer *buf) {
+  for (int i = 0; i < cs->visited_count; i++) {
+    if (cs->visited[i] == buf)
+      return i;
+  }
+  return -1;
+}
+
+static bool mark_visited(struct compile_state *cs, shader_buffer *buf) {
+  if (cs->visited_count == cs->visited_capacity) {
+    int capacity = cs->visited_capacity ? cs->visited_capacity * 2 : 8;
+    shader_buffer **visited =
+        realloc(cs->visited, capacity * sizeof(shader_buffer *));
+    if (!visited)
+      return false;
+    cs->visited = visited;
+    enum visit_state *state =
+        realloc(cs->state, capacity * sizeof(enum visit_state));
+    if (!state)
+      return false;
+    cs->state = state;
+    cs->visited_capacity = capacity;
+  }
+  cs->visited[cs->visited_count] = buf;
+  cs->state[cs->visited_count] = ON_STACK;
+  cs->visited_count++;
+  return true;
+}
+
+// Depth-first walk in channel order. A pass is emitted after all of its
+// inputs, and a channel pointing back at a buffer still on the stack becomes
+// a feedback edge that samples the previous frame. This mirrors the order the
+// recursive renderer used to produce.
+static bool visit(struct compile_state *cs, shader_buffer *buf) {
+  if (!mark_visited(cs, buf))
+    return false;
+  int slot = cs->visited_count - 1;
+
+  for (int i = 0; i < 10; i++) {
+    if (!buf->channel[i] || buf->channel[i]->type != BUFFER)
+      continue;
+    int other = find_visited(cs, buf->channel[i]->buf);
+    if (other < 0 && !visit(cs, buf->channel[i]->buf))
+      return false;
+  }
+
+  render_graph *graph = cs->graph;
+  render_pass *passes =
+      realloc(graph->passes, (graph->pass_count + 1) * sizeof(render_pass));
+  if (!passes)
+    return false;
+  graph->passes = passes;
+
+  render_pass *pass = &graph->passes[graph->pass_count];
+  pass->buf = buf;
+  pass->feedback_source = false;
+  buf->index = graph->pass_count++;
+  cs->state[slot] = DONE;
+
+  // Every input is either emitted (dependency) or still on the stack
+  // (feedback) at this point
+  for (int i = 0; i < 10; i++) {
+    pass->source[i] = -1;
+    pass->feedback[i] = false;
+    if (!buf->channel[i] || buf->channel[i]->type != BUFFER)
+      continue;
+    int other = find_visited(cs, buf->channel[i]->buf);
+    if (cs->state[other] == ON_STACK || buf->channel[i]->buf == buf) {
+      pass->feedback[i] = true;
+    } else {
+      pass->source[i] = buf->channel[i]->buf->index;
+    }
+  }
+
+  return true;
+}
+
+render_graph *render_graph_compile(shader_buffer *main_buf) {
+  if (!main_buf)
+    return NULL;
+
+  render_graph *graph = calloc(1, sizeof(render_graph));
+  if (!graph)
+    return NULL;
+
+  struct compile_state cs = {.graph = graph};
+  bool ok = visit(&cs, main_buf);
+  free(cs.visited);
+  free(cs.state);
+  if (!ok) {
+    render_graph_free(graph);
+    return NULL;
+  }
+
+  // Feedback sources are only known once every buffer has an index
+  for (int p = 0; p < graph->pass_count; p++) {
+    render_pass *pass = &graph->passes[p];
+    for (int i = 0; i < 10; i++) {
+      if (!pass->feedback[i])
+        continue;
+      int source = pass->buf->channel[i]->buf->index;
+      pass->source[i] = source;
+      graph->passes[source].feedback_source = true;
+    }
+  }
+
+  return graph;
+}
+
+void render_graph_dump(render_graph *graph, FILE *out) {
+  if (!graph)
+    return;
+
+  fprintf(out, "Render graph (%d passes):\n", graph->pass_count);
+  for (int p = 0; p < graph->pass_count; p++) {
+    render_pass *pass = &graph->passes[p];
+    fprintf(out, "  pass %d: %s%s%s\n", p, pass->buf->shader_path,
+            p == graph->pass_count - 1 ? " [output]" : "",
+            pass->feedback_source ? " [feedback]" : "");
+    for (int i = 0; i < 10; i++) {
+      shader_channel *channel = pass->buf->channel[i];
+      if (!channel)
+        continue;
+      switch (channel->type) {
+      case BUFFER:
+        fprintf(out, "    iChannel%d <- pass %d%s\n", i, pass->source[i],
+                pass->feedback[i] ? " (previous frame)" : "");
+        break;
+      case TEXTURE:
+        fprintf(out, "    iChannel%d <- texture %s\n", i,
+                channel->tex->path ? channel->tex->path : "(builtin)");
+        break;
+      case VIDEO:
+        fprintf(out, "    iChannel%d <- video %s\n", i, channel->vid->path);
+        break;
+      case AUDIO:
+        fprintf(out, "    iChannel%d <- audio %s\n", i, channel->aud->path);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+void render_graph_free(render_graph *graph) {
+  if (!graph)
+    return;
+  free(graph->passes);
+  free(graph);
+}
@@ -1,9 +1,17 @@
 #include "shader.h"
+#include "frame_stats.h"
+#include "gl_state.h"
+#include "gpu_timer.h"
+#include "program_cache.h"
+#include "render_graph.h"
 #include "resource_registry.h"
+#include "shader_audio.h"
 #include "shader_buffer.h"
 #include "shader_channel.h"
 #include "shader_texture.h"
 #include "shader_uniform.h"
+#include "shader_video.h"
+#include "shader_watch.h"
 #include "stb_image.h"
 #include "util.h"
 #include <EGL/egl.h>
@@ -27,14 +35,21 @@ static const char *FRAGMENT_SHADER_TEMPLATE =
     "#version 320 es\n"
     "precision highp int;\n"
     "precision highp float;\n"
-    "uniform vec3 iResolution;\n"
-    "uniform float iTime;\n"
-    "uniform float iTimeDelta;\n"
-    "uniform int iFrame;\n"
-    "uniform float iFrameRate;\n"
-    "uniform vec4 iMouse;\n"
-    "uniform vec2 iMousePos;\n"
-    "uniform vec4 iDate;\n"
+    "layout(std140) uniform WlsbgFrame {\n"
+    "    vec4 iDate;\n"
+    "    float iTime;\n"
+    "    float iTimeDelta;\n"
+    "    float iFrameRate;\n"
+    "    int iFrame;\n"
+    "};\n"
+    "layout(std140) uniform WlsbgPass {\n"
+    "    vec3 iResolution;\n"
+    "    vec4 iMouse;\n"
+    "    vec2 iMousePos;\n"
+    "    vec3 iChannelResolution[10];\n"
+    "    float iChannelDuration[10];\n"
+    "    float iChannelHistoryRow[10];\n"
+    "};\n"
     "uniform sampler2D iChannel0;\n"
     "uniform sampler2D iChannel1;\n"
     "uniform sampler2D iChannel2;\n"
@@ -45,8 +60,6 @@ static const char *FRAGMENT_SHADER_TEMPLATE =
     "uniform sampler2D iChannel7;\n"
     "uniform sampler2D iChannel8;\n"
     "uniform sampler2D iChannel9;\n"
-    "uniform vec3 iChannelResolution[10];\n"
-    "uniform vec3 iChannelDuration[10];\n"
     "out vec4 fragColor;\n"
     "%s\n"
     "%s\n"
@@ -61,45 +74,110 @@ static const float vertices[] = {
     3.0f,  1.0f   // Top-right (extends beyond screen)
 };
 
-GLuint compile_shader(GLenum type, const char *source) {
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+typedef void (*max_shader_compiler_threads_fn)(GLuint count);
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+#define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+// Whether compile and link status can be polled without blocking
+static bool parallel_compile = false;
+
+static bool has_gl_extension(const char *name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (ext && strcmp(ext, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void setup_parallel_compile() {
+  parallel_compile = has_gl_extension("GL_KHR_parallel_shader_compile");
+  if (!parallel_compile)
+    return;
+
+  // Let the driver use as many compiler threads as it likes
+  max_shader_compiler_threads_fn max_threads =
+      (max_shader_compiler_threads_fn)eglGetProcAddress(
+          "glMaxShaderCompilerThreadsKHR");
+  if (max_threads)
+    max_threads(0xFFFFFFFF);
+}
+
+// Only submits the compile, the status is checked by check_shader
+static GLuint submit_shader(GLenum type, const char *source) {
   GLuint shader = glCreateShader(type);
   if (!shader)
     return 0;
 
   glShaderSource(shader, 1, &source, NULL);
   glCompileShader(shader);
+  return shader;
+}
 
+static bool check_shader(GLuint shader) {
   GLint success;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
   if (!success) {
     char info_log[512];
     glGetShaderInfoLog(shader, 512, NULL, info_log);
     fprintf(stderr, "Shader compilation failed: %s\n", info_log);
+    return false;
+  }
+  return true;
+}
+
+GLuint compile_shader(GLenum type, const char *source) {
+  GLuint shader = submit_shader(type, source);
+  if (!shader)
+    return 0;
+
+  if (!check_shader(shader)) {
     glDeleteShader(shader);
     return 0;
   }
   return shader;
 }
 
-bool compile_and_link_program(GLuint *program, char *shader_path,
-                              char *shared_shader_path) {
+shader_program_build *submit_program(char *shader_path,
+                                     char *shared_shader_path) {
   char *fragment_shader_shard = load_file(shader_path);
-  if (!fragment_shader_shard)
-    return false;
+  if (!fragment_shader_shard) {
+    fprintf(stderr, "Error: Could not read shader '%s'\n", shader_path);
+    return NULL;
+  }
 
   char *shared_fragment_file =
       shared_shader_path ? load_file(shared_shader_path) : NULL;
   char *shared_fragment_shard =
       shared_fragment_file ? shared_fragment_file : "";
 
+  shader_program_build *build = calloc(1, sizeof(shader_program_build));
+
   // Create fragment shader
   size_t buf_size =
       strlen(shared_fragment_shard) + strlen(fragment_shader_shard) + 1024;
   char *fragment_shader_source = malloc(buf_size);
-  if (!fragment_shader_source) {
+  if (!build || !fragment_shader_source) {
+    free(build);
+    free(fragment_shader_source);
     free(fragment_shader_shard);
     free(shared_fragment_file);
-    return false;
+    return NULL;
   }
 
   snprintf(fragment_shader_source, buf_size, FRAGMENT_SHADER_TEMPLATE,
@@ -108,66 +186,166 @@ bool compile_and_link_program(GLuint *program, char *shader_path,
   free(fragment_shader_shard);
   free(shared_fragment_file);
 
-  GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, VERTEX_SHADER_SOURCE);
-  GLuint fragment_shader =
-      compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+  // Skip compilation entirely when this exact program was linked before
+  build->cache_key =
+      program_cache_key(VERTEX_SHADER_SOURCE, fragment_shader_source);
+  if (program_cache_load(&build->program, build->cache_key)) {
+    build->cached = true;
+    free(fragment_shader_source);
+    return build;
+  }
+
+  // Queue the compile and link without looking at their status, so the
+  // driver can work on every program at once
+  build->vertex_shader = submit_shader(GL_VERTEX_SHADER, VERTEX_SHADER_SOURCE);
+  build->fragment_shader =
+      submit_shader(GL_FRAGMENT_SHADER, fragment_shader_source);
+  build->program = glCreateProgram();
 
   free(fragment_shader_source);
 
-  if (!vertex_shader || !fragment_shader) {
-    if (vertex_shader)
-      glDeleteShader(vertex_shader);
-    if (fragment_shader)
-      glDeleteShader(fragment_shader);
-    return false;
+  if (!build->vertex_shader || !build->fragment_shader || !build->program) {
+    cancel_program(build);
+    return NULL;
   }
 
-  // Link program
-  *program = glCreateProgram();
-  if (!*program) {
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-    return false;
-  }
+  glAttachShader(build->program, build->vertex_shader);
+  glAttachShader(build->program, build->fragment_shader);
+  glProgramParameteri(build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+                      GL_TRUE);
+  glLinkProgram(build->program);
 
-  glAttachShader(*program, vertex_shader);
-  glAttachShader(*program, fragment_shader);
-  glLinkProgram(*program);
+  return build;
+}
 
-  glDeleteShader(vertex_shader);
-  glDeleteShader(fragment_shader);
+bool program_build_done(shader_program_build *build) {
+  if (build->cached || !parallel_compile)
+    return true;
+
+  GLint done = GL_FALSE;
+  glGetProgramiv(build->program, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
+
+bool finish_program(shader_program_build *build, GLuint *program) {
+  if (build->cached) {
+    *program = build->program;
+    free(build);
+    return true;
+  }
+
+  // Compile errors are more useful than the link error they cause
+  if (!check_shader(build->vertex_shader) ||
+      !check_shader(build->fragment_shader)) {
+    cancel_program(build);
+    return false;
+  }
 
   GLint success;
-  glGetProgramiv(*program, GL_LINK_STATUS, &success);
+  glGetProgramiv(build->program, GL_LINK_STATUS, &success);
   if (!success) {
     char info_log[512];
-    glGetProgramInfoLog(*program, 512, NULL, info_log);
+    glGetProgramInfoLog(build->program, 512, NULL, info_log);
     fprintf(stderr, "Program linking failed: %s\n", info_log);
-    glDeleteProgram(*program);
-    *program = 0;
+    cancel_program(build);
     return false;
   }
 
+  program_cache_store(build->program, build->cache_key);
+
+  *program = build->program;
+  build->program = 0;
+  cancel_program(build);
   return true;
 }
 
-shader_context *shader_create(struct wl_display *display,
-                              struct wl_surface *surface, char *shader_path,
-                              char *shared_shader_path, int width, int height,
-                              char *channel_input[10]) {
-  shader_context *ctx = malloc(sizeof(shader_context));
-  if (!ctx)
-    return NULL;
+void cancel_program(shader_program_build *build) {
+  if (!build)
+    return;
+
+  if (build->vertex_shader)
+    glDeleteShader(build->vertex_shader);
+  if (build->fragment_shader)
+    glDeleteShader(build->fragment_shader);
+  if (build->program)
+    glDeleteProgram(build->program);
+  free(build);
+}
+
+bool compile_and_link_program(GLuint *program, char *shader_path,
+                              char *shared_shader_path) {
+  shader_program_build *build = submit_program(shader_path, shared_shader_path);
+  return build && finish_program(build, program);
+}
 
-  // Initialize EGL
+// Picks up every program whose build has finished, or waits for all of them.
+// Without GL_KHR_parallel_shader_compile any status query blocks, so unless
+// waiting that only happens once a placeholder frame is on screen.
+static bool collect_programs(shader_context *ctx, bool wait) {
+  bool ready = true;
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    shader_buffer *buf = ctx->graph->passes[i].buf;
+    if (!buf->build)
+      continue;
+
+    if (!wait && !buf->build->cached && !ctx->presented) {
+      ready = false;
+      continue;
+    }
+    if (!wait && !program_build_done(buf->build)) {
+      ready = false;
+      continue;
+    }
+
+    shader_program_build *build = buf->build;
+    buf->build = NULL;
+    if (!finish_program(build, &buf->program)) {
+      fprintf(stderr, "Error: Could not build shader '%s'\n",
+              buf->shader_path);
+      return false;
+    }
+    set_uniform_locations(buf->program, buf->u);
+  }
+
+  ctx->ready = ready;
+  return true;
+}
+
+// Swaps in rebuilt programs of changed shader files. A program that fails to
+// build is dropped and the buffer keeps running the previous one.
+static void collect_reloads(shader_context *ctx) {
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    shader_buffer *buf = ctx->graph->passes[i].buf;
+    if (!buf->reload || !program_build_done(buf->reload))
+      continue;
+
+    shader_program_build *build = buf->reload;
+    buf->reload = NULL;
+    GLuint program;
+    if (!finish_program(build, &program)) {
+      fprintf(stderr, "Keeping the previous program for '%s'\n",
+              buf->shader_path);
+      continue;
+    }
+
+    glDeleteProgram(buf->program);
+    buf->program = program;
+    set_uniform_locations(buf->program, buf->u);
+    fprintf(stderr, "Reloaded '%s'\n", buf->shader_path);
+  }
+}
+
+// Sets up EGL on the given platform and makes a context current
+static bool init_egl(shader_context *ctx, EGLenum platform,
+                     const char *platform_extension, void *native_display,
+                     EGLint surface_type) {
   const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
-  if (!extensions || !strstr(extensions, "EGL_KHR_platform_wayland")) {
-    fprintf(stderr, "EGL Wayland platform not supported\n");
+  if (!extensions || !strstr(extensions, platform_extension)) {
+    fprintf(stderr, "%s not supported\n", platform_extension);
     goto error;
   }
 
-  ctx->egl_display =
-      eglGetPlatformDisplay(EGL_PLATFORM_WAYLAND_KHR, display, NULL);
+  ctx->egl_display = eglGetPlatformDisplay(platform, native_display, NULL);
   if (ctx->egl_display == EGL_NO_DISPLAY)
     goto error;
 
@@ -176,9 +354,19 @@ shader_context *shader_create(struct wl_display *display,
   if (!eglBindAPI(EGL_OPENGL_ES_API))
     goto error;
 
+  // The context is created before any output is configured, so resources are
+  // loaded with no surface bound
+  const char *display_extensions =
+      eglQueryString(ctx->egl_display, EGL_EXTENSIONS);
+  if (!display_extensions ||
+      !strstr(display_extensions, "EGL_KHR_surfaceless_context")) {
+    fprintf(stderr, "EGL surfaceless context not supported\n");
+    goto error;
+  }
+
   // Simple config selection
   EGLint config_attribs[] = {EGL_SURFACE_TYPE,
-                             EGL_WINDOW_BIT,
+                             surface_type,
                              EGL_RED_SIZE,
                              8,
                              EGL_GREEN_SIZE,
@@ -207,25 +395,20 @@ shader_context *shader_create(struct wl_display *display,
   if (ctx->egl_context == EGL_NO_CONTEXT)
     goto error;
 
-  // Create EGL window and surface
-  ctx->egl_window = wl_egl_window_create(surface, width, height);
-  if (!ctx->egl_window)
-    goto error;
-
-  ctx->egl_surface =
-      eglCreateWindowSurface(ctx->egl_display, ctx->egl_config,
-                             (EGLNativeWindowType)ctx->egl_window, NULL);
-  if (ctx->egl_surface == EGL_NO_SURFACE)
-    goto error;
-
   // Make context current
-  if (!eglMakeCurrent(ctx->egl_display, ctx->egl_surface, ctx->egl_surface,
+  if (!eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
                       ctx->egl_context))
     goto error;
 
-  // Disable vsync for manual timing control
-  eglSwapInterval(ctx->egl_display, 0);
+  return true;
 
+error:
+  return false;
+}
+
+// Loads every resource into the current context
+static bool init_context(shader_context *ctx, char *shader_path,
+                         char *shared_shader_path, char *channel_input[10]) {
   // Create vertex buffer
   glGenVertexArrays(1, &ctx->vao);
   glGenBuffers(1, &ctx->vbo);
@@ -237,10 +420,14 @@ shader_context *shader_create(struct wl_display *display,
   glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void *)0);
   glEnableVertexAttribArray(0);
 
-  // Allocate main buffer
+  setup_parallel_compile();
+
+  // Allocate main buffer, always at the full output resolution
   ctx->buf = calloc(1, sizeof(shader_buffer));
   if (!ctx->buf)
     goto error;
+  ctx->buf->scale = 1;
+  ctx->buf->format = default_buffer_format();
 
   // Create a registry
   ctx->registry = NULL;
@@ -284,22 +471,97 @@ shader_context *shader_create(struct wl_display *display,
   if (!ctx->buf->shader_path) {
     goto error;
   }
-  if (!init_shader_buffer(ctx->buf, width, height, shared_shader_path)) {
+  if (!init_shader_buffer(ctx->buf, shared_shader_path)) {
     goto error;
   }
 
+  // Flatten the buffer tree into an ordered pass list
+  ctx->graph = render_graph_compile(ctx->buf);
+  if (!ctx->graph)
+    goto error;
+
+  // Programs restored from the cache are usable right away
+  if (!collect_programs(ctx, false))
+    goto error;
+
+  if (shared_shader_path) {
+    ctx->shared_shader_path = strdup(shared_shader_path);
+    if (!ctx->shared_shader_path)
+      goto error;
+  }
+
   ctx->initialized = true;
-  return ctx;
+  return true;
 
 error:
-  shader_destroy(ctx);
-  return NULL;
+  return false;
 }
 
-void shader_render(shader_context *ctx, struct timespec start_time,
-                   iMouse *mouse) {
+shader_context *shader_create(struct wl_display *display, char *shader_path,
+                              char *shared_shader_path,
+                              char *channel_input[10]) {
+  shader_context *ctx = calloc(1, sizeof(shader_context));
+  if (!ctx)
+    return NULL;
+
+  if (!init_egl(ctx, EGL_PLATFORM_WAYLAND_KHR, "EGL_KHR_platform_wayland",
+                display, EGL_WINDOW_BIT) ||
+      !init_context(ctx, shader_path, shared_shader_path, channel_input)) {
+    shader_destroy(ctx);
+    return NULL;
+  }
+
+  // Reloading is a convenience, so carry on without it
+  ctx->watch = shader_watch_create(ctx->graph, ctx->shared_shader_path);
+  return ctx;
+}
+
+// A context with no display server, rendering only into offscreen surfaces.
+// Works on any Mesa driver including llvmpipe. Sets unavailable when the
+// failure was EGL lacking surfaceless support rather than the shader.
+shader_context *shader_create_headless(char *shader_path,
+                                       char *shared_shader_path,
+                                       char *channel_input[10],
+                                       bool *unavailable) {
+  *unavailable = false;
+  shader_context *ctx = calloc(1, sizeof(shader_context));
+  if (!ctx)
+    return NULL;
+
+  if (!init_egl(ctx, EGL_PLATFORM_SURFACELESS_MESA,
+                "EGL_MESA_platform_surfaceless", EGL_DEFAULT_DISPLAY,
+                EGL_PBUFFER_BIT)) {
+    *unavailable = true;
+    shader_destroy(ctx);
+    return NULL;
+  }
+  if (!init_context(ctx, shader_path, shared_shader_path, channel_input)) {
+    shader_destroy(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+// Waits for all submitted GPU work to complete
+void shader_finish(shader_context *ctx) {
+  if (ctx && ctx->initialized)
+    glFinish();
+}
+
+// Blocks until every pending program is built
+bool shader_wait_ready(shader_context *ctx) {
   if (!ctx || !ctx->initialized)
-    return;
+    return false;
+  return ctx->ready || collect_programs(ctx, true);
+}
+
+bool shader_update(shader_context *ctx, struct timespec start_time) {
+  if (!ctx || !ctx->initialized)
+    return false;
+
+  if (!ctx->ready && !collect_programs(ctx, false))
+    return false;
+  collect_reloads(ctx);
 
   // Set current key state
   // First 256 - Key down
@@ -326,29 +588,39 @@ void shader_render(shader_context *ctx, struct timespec start_time,
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 3, GL_RED, GL_UNSIGNED_BYTE,
                   key);
 
-  render_shader_buffer(ctx, ctx->buf, start_time, mouse);
-
-  // Make context current
-  eglMakeCurrent(ctx->egl_display, ctx->egl_surface, ctx->egl_surface,
-                 ctx->egl_context);
-
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, ctx->buf->fbo);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-  glBlitFramebuffer(0, 0, ctx->buf->width, ctx->buf->height, 0, 0,
-                    ctx->buf->width, ctx->buf->height, GL_COLOR_BUFFER_BIT,
-                    GL_NEAREST);
+  if (ctx->profiling)
+    gpu_timer_begin_frame();
 
-  // Swap buffers
-  eglSwapBuffers(ctx->egl_display, ctx->egl_surface);
-}
-
-void shader_resize(shader_context *ctx, int width, int height) {
-  if (!ctx || !ctx->egl_window)
-    return;
+  // Media is shared by all outputs, so it advances once per frame
+  int video = 0;
+  for (resource_registry *cur = ctx->registry; cur; cur = cur->next) {
+    switch (cur->type) {
+    case VIDEO: {
+      gpu_timer *timer = ctx->profiling ? ctx->video_timers[video] : NULL;
+      video++;
+      int64_t update_start = current_time_in_ns();
+      shader_video_update(cur->channel->vid, start_time);
+      frame_stats_add(STAT_VIDEO_UPDATE, current_time_in_ns() - update_start);
+      gpu_timer_collect(timer);
+      gpu_timer_begin(timer);
+      shader_video_render(cur->channel->vid);
+      gpu_timer_end(timer);
+      break;
+    }
+    case AUDIO: {
+      int64_t update_start = current_time_in_ns();
+      shader_audio_update(cur->channel->aud, start_time);
+      frame_stats_add(STAT_AUDIO_UPDATE, current_time_in_ns() - update_start);
+      break;
+    }
+    default:
+      break;
+    }
+  }
 
-  ctx->buf->width = width;
-  ctx->buf->height = height;
-  wl_egl_window_resize(ctx->egl_window, width, height, 0, 0);
+  // Texture uploads and mpv rendering bypass the state cache
+  gl_state_invalidate();
+  return true;
 }
 
 void shader_destroy(shader_context *ctx) {
@@ -356,8 +628,9 @@ void shader_destroy(shader_context *ctx) {
     return;
 
   if (ctx->egl_display) {
-    eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
-                   EGL_NO_CONTEXT);
+    if (ctx->egl_context)
+      eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     ctx->egl_context);
 
     if (ctx->vao)
       glDeleteVertexArrays(1, &ctx->vao);
@@ -368,19 +641,452 @@ void shader_destroy(shader_context *ctx) {
       glDeleteTextures(1, &ctx->keyboard.tex);
     }
 
+    for (int i = 0; i < ctx->video_timer_count; i++)
+      gpu_timer_free(ctx->video_timers[i]);
+    free(ctx->video_timers);
+
     registry_free(ctx->registry);
 
     free_shader_buffer(ctx->buf);
 
-    if (ctx->egl_surface)
-      eglDestroySurface(ctx->egl_display, ctx->egl_surface);
+    eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   EGL_NO_CONTEXT);
+
     if (ctx->egl_context)
       eglDestroyContext(ctx->egl_display, ctx->egl_context);
-    if (ctx->egl_window)
-      wl_egl_window_destroy(ctx->egl_window);
 
     eglTerminate(ctx->egl_display);
   }
 
+  shader_watch_free(ctx->watch);
+  render_graph_free(ctx->graph);
+  free(ctx->shared_shader_path);
   free(ctx);
 }
+
+int shader_watch_fd(shader_context *ctx) {
+  return ctx && ctx->watch ? ctx->watch->fd : -1;
+}
+
+// Resubmits the programs of every changed shader file. The running programs,
+// render targets and media are untouched until the rebuild succeeds.
+void shader_reload(shader_context *ctx) {
+  if (!ctx || !ctx->watch)
+    return;
+
+  bool *changed = calloc(ctx->graph->pass_count, sizeof(bool));
+  if (!changed)
+    return;
+  if (!shader_watch_read(ctx->watch, changed, ctx->graph->pass_count)) {
+    free(changed);
+    return;
+  }
+
+  eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 ctx->egl_context);
+
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    if (!changed[i])
+      continue;
+    shader_buffer *buf = ctx->graph->passes[i].buf;
+
+    // An edit while a build is still running supersedes it
+    shader_program_build *build =
+        submit_program(buf->shader_path, ctx->shared_shader_path);
+    if (!build)
+      continue;
+    if (buf->build) {
+      cancel_program(buf->build);
+      buf->build = build;
+    } else {
+      cancel_program(buf->reload);
+      buf->reload = build;
+    }
+  }
+
+  free(changed);
+  gl_state_invalidate();
+}
+
+// Must be called before any surface is created, which is when the per-pass
+// timers are allocated
+bool shader_enable_profiling(shader_context *ctx) {
+  if (!ctx)
+    return false;
+
+  eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 ctx->egl_context);
+  if (!gpu_timer_supported()) {
+    fprintf(stderr, "GL_EXT_disjoint_timer_query not supported, GPU timing "
+                    "is unavailable\n");
+    return false;
+  }
+
+  for (resource_registry *cur = ctx->registry; cur; cur = cur->next) {
+    if (cur->type != VIDEO)
+      continue;
+    gpu_timer **timers = realloc(
+        ctx->video_timers, (ctx->video_timer_count + 1) * sizeof(gpu_timer *));
+    if (!timers)
+      return false;
+    ctx->video_timers = timers;
+
+    char label[64];
+    const char *name = strrchr(cur->channel->vid->path, '/');
+    snprintf(label, sizeof(label), "video: %s",
+             name ? name + 1 : cur->channel->vid->path);
+    ctx->video_timers[ctx->video_timer_count++] = gpu_timer_create(label);
+  }
+
+  ctx->profiling = true;
+  return true;
+}
+
+// Free video memory in KiB, or -1 where the driver does not report it
+// (GL_NVX_gpu_memory_info and GL_ATI_meminfo, not on Mesa's llvmpipe)
+int64_t shader_free_video_memory(shader_context *ctx) {
+  if (!ctx || !ctx->initialized)
+    return -1;
+
+  eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 ctx->egl_context);
+  if (has_gl_extension("GL_NVX_gpu_memory_info")) {
+    GLint available = 0;
+    glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+    return available;
+  }
+  if (has_gl_extension("GL_ATI_meminfo")) {
+    GLint info[4] = {0}; // Total free, largest block, auxiliary free and block
+    glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+    return info[0];
+  }
+  return -1;
+}
+
+void shader_report_profile(shader_context *ctx, FILE *out) {
+  if (!ctx || !ctx->profiling)
+    return;
+
+  if (ctx->video_timer_count > 0) {
+    fprintf(out, "GPU time of shared resources:\n");
+    for (int i = 0; i < ctx->video_timer_count; i++)
+      gpu_timer_report(ctx->video_timers[i], out);
+  }
+
+  const gl_state *gl = gl_state_get();
+  fprintf(out, "GL state calls in the last frame: %u issued, %u skipped\n",
+          gl->last_issued, gl->last_skipped);
+}
+
+// Allocates the render target of every buffer, the uniform buffer and the GPU
+// timers of a surface. The context must be current.
+static bool init_surface_targets(shader_surface *surf) {
+  shader_context *ctx = surf->ctx;
+  surf->targets = calloc(ctx->graph->pass_count, sizeof(shader_target));
+  if (!surf->targets)
+    return false;
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    // The main image draws into the window unless its previous frame is
+    // sampled, which needs a texture that outlives the swap
+    render_pass *pass = &ctx->graph->passes[i];
+    bool window = pass->buf == ctx->buf && !pass->feedback_source &&
+                  surf->egl_surface != EGL_NO_SURFACE;
+    if (!init_shader_target(&surf->targets[i], pass, surf->width, surf->height,
+                            window))
+      return false;
+  }
+
+  if (!init_uniform_buffer(surf))
+    return false;
+  gl_state_invalidate();
+
+  if (ctx->profiling) {
+    surf->pass_timers = calloc(ctx->graph->pass_count, sizeof(gpu_timer *));
+    if (!surf->pass_timers)
+      return false;
+    for (int i = 0; i < ctx->graph->pass_count; i++) {
+      char label[64];
+      const char *path = ctx->graph->passes[i].buf->shader_path;
+      const char *name = strrchr(path, '/');
+      snprintf(label, sizeof(label), "pass %d: %s", i, name ? name + 1 : path);
+      surf->pass_timers[i] = gpu_timer_create(label);
+    }
+    surf->blit_timer = gpu_timer_create("blit");
+  }
+
+  return true;
+}
+
+shader_surface *shader_surface_create(shader_context *ctx,
+                                      struct wl_surface *surface, int width,
+                                      int height) {
+  if (!ctx || !ctx->initialized)
+    return NULL;
+
+  shader_surface *surf = calloc(1, sizeof(shader_surface));
+  if (!surf)
+    return NULL;
+  surf->ctx = ctx;
+  surf->width = width;
+  surf->height = height;
+
+  // Create EGL window and surface
+  surf->egl_window = wl_egl_window_create(surface, width, height);
+  if (!surf->egl_window)
+    goto error;
+
+  surf->egl_surface =
+      eglCreateWindowSurface(ctx->egl_display, ctx->egl_config,
+                             (EGLNativeWindowType)surf->egl_window, NULL);
+  if (surf->egl_surface == EGL_NO_SURFACE)
+    goto error;
+
+  // Make context current
+  if (!eglMakeCurrent(ctx->egl_display, surf->egl_surface, surf->egl_surface,
+                      ctx->egl_context))
+    goto error;
+
+  // Disable vsync for manual timing control
+  eglSwapInterval(ctx->egl_display, 0);
+
+  if (!init_surface_targets(surf))
+    goto error;
+
+  return surf;
+
+error:
+  shader_surface_destroy(surf);
+  return NULL;
+}
+
+// A surface with no window; the main image stays in its own texture, see
+// shader_surface_main_texture
+shader_surface *shader_surface_create_offscreen(shader_context *ctx, int width,
+                                                int height) {
+  if (!ctx || !ctx->initialized)
+    return NULL;
+
+  shader_surface *surf = calloc(1, sizeof(shader_surface));
+  if (!surf)
+    return NULL;
+  surf->ctx = ctx;
+  surf->width = width;
+  surf->height = height;
+  surf->egl_surface = EGL_NO_SURFACE;
+
+  if (!eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      ctx->egl_context) ||
+      !init_surface_targets(surf)) {
+    shader_surface_destroy(surf);
+    return NULL;
+  }
+  return surf;
+}
+
+// Copies the latest main image of an offscreen surface into rgba (width *
+// height * 4 bytes, top row first). The image is blitted into an RGBA8
+// renderbuffer first, since reading float targets as bytes isn't allowed.
+bool shader_surface_read_pixels(shader_surface *surface, unsigned char *rgba) {
+  shader_context *ctx = surface->ctx;
+  shader_target *target = &surface->targets[ctx->buf->index];
+  if (target->texture_count == 0)
+    return false;
+
+  eglMakeCurrent(ctx->egl_display, surface->egl_surface, surface->egl_surface,
+                 ctx->egl_context);
+
+  GLuint fbo, renderbuffer;
+  glGenRenderbuffers(1, &renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, target->width,
+                        target->height);
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, renderbuffer);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, target->fbo[target->current_texture]);
+  glBlitFramebuffer(0, 0, target->width, target->height, 0, 0, target->width,
+                    target->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, target->width, target->height, GL_RGBA, GL_UNSIGNED_BYTE,
+               rgba);
+  bool ok = glGetError() == GL_NO_ERROR;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteFramebuffers(1, &fbo);
+  glDeleteRenderbuffers(1, &renderbuffer);
+  gl_state_invalidate();
+
+  // GL rows start at the bottom
+  size_t row_size = (size_t)target->width * 4;
+  unsigned char *row = malloc(row_size);
+  if (!row)
+    return false;
+  for (int y = 0; y < target->height / 2; y++) {
+    unsigned char *top = rgba + y * row_size;
+    unsigned char *bottom = rgba + (target->height - 1 - y) * row_size;
+    memcpy(row, top, row_size);
+    memcpy(top, bottom, row_size);
+    memcpy(bottom, row, row_size);
+  }
+  free(row);
+
+  return ok;
+}
+
+GLuint shader_surface_main_texture(shader_surface *surface) {
+  shader_target *target = &surface->targets[surface->ctx->buf->index];
+  if (target->texture_count == 0)
+    return 0;
+  return target->textures[target->current_texture];
+}
+
+static void swap_buffers(shader_surface *surface) {
+  if (surface->egl_surface == EGL_NO_SURFACE) {
+    glFlush();
+    return;
+  }
+
+  int64_t swap_start = current_time_in_ns();
+  eglSwapBuffers(surface->ctx->egl_display, surface->egl_surface);
+  frame_stats_add(STAT_SWAP, current_time_in_ns() - swap_start);
+}
+
+void shader_render(shader_surface *surface, struct timespec start_time,
+                   iMouse *mouse) {
+  if (!surface)
+    return;
+  shader_context *ctx = surface->ctx;
+
+  // Make context current
+  eglMakeCurrent(ctx->egl_display, surface->egl_surface, surface->egl_surface,
+                 ctx->egl_context);
+
+  gl_state_begin_frame();
+
+  // Show a solid color until every pass has a linked program
+  if (!ctx->ready) {
+    if (surface->egl_surface == EGL_NO_SURFACE)
+      return;
+
+    gl_bind_framebuffer(0);
+    gl_viewport(0, 0, surface->width, surface->height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    swap_buffers(surface);
+    ctx->presented = true;
+    return;
+  }
+
+  shader_surface_collect_profile(surface);
+
+  // One clock snapshot shared by every pass of this frame
+  double elapsed_time = time_elapsed(start_time);
+  update_uniform_buffer(surface, elapsed_time, mouse);
+
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    render_shader_buffer(surface, &ctx->graph->passes[i]);
+  }
+
+  // Update state for next frame
+  surface->last_time = elapsed_time;
+  surface->frame++;
+
+  // Copy the main image to the window if it was rendered offscreen
+  shader_target *target = &surface->targets[ctx->buf->index];
+  if (target->texture_count > 0 && surface->egl_surface != EGL_NO_SURFACE) {
+    gpu_timer_begin(surface->blit_timer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER,
+                      target->fbo[target->current_texture]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, target->width, target->height, 0, 0,
+                      target->width, target->height, GL_COLOR_BUFFER_BIT,
+                      GL_NEAREST);
+    gpu_timer_end(surface->blit_timer);
+    gl_state_invalidate();
+  }
+
+  swap_buffers(surface);
+}
+
+void shader_surface_resize(shader_surface *surface, int width, int height) {
+  if (!surface || !surface->egl_window)
+    return;
+
+  surface->width = width;
+  surface->height = height;
+  wl_egl_window_resize(surface->egl_window, width, height, 0, 0);
+
+  shader_context *ctx = surface->ctx;
+  eglMakeCurrent(ctx->egl_display, surface->egl_surface, surface->egl_surface,
+                 ctx->egl_context);
+  for (int i = 0; i < ctx->graph->pass_count; i++) {
+    resize_shader_target(&surface->targets[i], &ctx->graph->passes[i], width,
+                         height);
+  }
+  gl_state_invalidate();
+}
+
+void shader_surface_destroy(shader_surface *surface) {
+  if (!surface)
+    return;
+
+  shader_context *ctx = surface->ctx;
+
+  // Release the surface before destroying it, keeping the shared context
+  eglMakeCurrent(ctx->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                 ctx->egl_context);
+
+  free_uniform_buffer(surface);
+  gl_state_invalidate();
+
+  if (surface->pass_timers) {
+    for (int i = 0; i < ctx->graph->pass_count; i++)
+      gpu_timer_free(surface->pass_timers[i]);
+    free(surface->pass_timers);
+  }
+  gpu_timer_free(surface->blit_timer);
+
+  if (surface->targets) {
+    for (int i = 0; i < ctx->graph->pass_count; i++) {
+      free_shader_target(&surface->targets[i]);
+    }
+    free(surface->targets);
+  }
+
+  if (surface->egl_surface)
+    eglDestroySurface(ctx->egl_display, surface->egl_surface);
+  if (surface->egl_window)
+    wl_egl_window_destroy(surface->egl_window);
+
+  free(surface);
+}
+
+// Reads back every finished GPU timing of this surface without waiting
+void shader_surface_collect_profile(shader_surface *surface) {
+  if (!surface || !surface->pass_timers)
+    return;
+
+  for (int i = 0; i < surface->ctx->graph->pass_count; i++)
+    gpu_timer_collect(surface->pass_timers[i]);
+  gpu_timer_collect(surface->blit_timer);
+  for (int i = 0; i < surface->ctx->video_timer_count; i++)
+    gpu_timer_collect(surface->ctx->video_timers[i]);
+}
+
+void shader_surface_report_profile(shader_surface *surface, const char *name,
+                                   FILE *out) {
+  if (!surface || !surface->pass_timers)
+    return;
+
+  fprintf(out, "GPU time on %s (%dx%d):\n", name ? name : "output",
+          surface->width, surface->height);
+  for (int i = 0; i < surface->ctx->graph->pass_count; i++)
+    gpu_timer_report(surface->pass_timers[i], out);
+  if (surface->targets[surface->ctx->buf->index].texture_count > 0 &&
+      surface->egl_surface != EGL_NO_SURFACE)
+    gpu_timer_report(surface->blit_timer, out);
+}
@@ -7,28 +7,86 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define PI_F 3.14159265358979323846f
+#define ROWS_FRESH 4u
+#define CAPTURE_PERIOD_MS 5
 
-void audio_data_callback(ma_device *device, void *output, const void *input,
-                         ma_uint32 frame_count) {
-  shader_audio *audio = (shader_audio *)device->pUserData;
-  if (!audio)
+// Every loaded audio file, so each is only decoded and played once
+static shader_audio *sources = NULL;
+
+// Set by --mute, makes every audio channel silent
+static bool muted = false;
+
+// FFTW's planner measures candidate algorithms on first use of a size; keep
+// what it learned next to the program binaries so later starts skip that
+static char *wisdom_path() {
+  char *dir = cache_dir();
+  if (!dir)
+    return NULL;
+
+  size_t size = strlen(dir) + sizeof("/fftw-wisdom");
+  char *path = malloc(size);
+  if (path)
+    snprintf(path, size, "%s/fftw-wisdom", dir);
+  free(dir);
+  return path;
+}
+
+// Exports to a temporary file and renames it into place, so concurrent
+// instances never leave a truncated wisdom file
+static void save_wisdom(const char *path) {
+  size_t tmp_size = strlen(path) + 16;
+  char *tmp_path = malloc(tmp_size);
+  if (!tmp_path)
     return;
 
-  (void)input; // input is not used in playback mode
+  snprintf(tmp_path, tmp_size, "%s.%d", path, (int)getpid());
+  if (!fftwf_export_wisdom_to_filename(tmp_path) ||
+      rename(tmp_path, path) != 0) {
+    fprintf(stderr, "Failed to save FFTW wisdom to '%s'\n", path);
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+}
 
+static fftwf_plan plan_fft(int size, float *in, fftwf_complex *out) {
+  static bool wisdom_loaded = false;
+  char *path = wisdom_path();
+  if (path && !wisdom_loaded) {
+    fftwf_import_wisdom_from_filename(path);
+    wisdom_loaded = true;
+  }
+
+  // Measuring overwrites the arrays, which are not filled yet
+  fftwf_plan plan =
+      fftwf_plan_dft_r2c_1d(size, in, out, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+  if (!plan) {
+    plan = fftwf_plan_dft_r2c_1d(size, in, out, FFTW_MEASURE);
+    if (plan && path)
+      save_wisdom(path);
+  }
+  free(path);
+  return plan;
+}
+
+// Decodes the next frames of the looping track, seeking when it has drifted
+// from the shader clock. Returns the number of frames read.
+static ma_uint64 decode_frames(shader_audio *audio, float *float_output,
+                               ma_uint64 frame_count) {
   ma_uint64 frames_read;
   ma_uint64 cursor;
 
   ma_result result;
-  result = ma_decoder_read_pcm_frames(&audio->decoder, audio->audio_buffer,
+  result = ma_decoder_read_pcm_frames(&audio->decoder, float_output,
                                       frame_count, &frames_read);
   // When audio playback finishes, loop
   if (result != MA_SUCCESS) {
     ma_decoder_seek_to_pcm_frame(&audio->decoder, 0);
-    ma_decoder_read_pcm_frames(&audio->decoder, audio->audio_buffer,
-                               frame_count, &frames_read);
+    ma_decoder_read_pcm_frames(&audio->decoder, float_output, frame_count,
+                               &frames_read);
   }
 
   // Check if we need to sync up
@@ -42,35 +100,163 @@ void audio_data_callback(ma_device *device, void *output, const void *input,
     if (time_diff > audio->seek_threshold) {
       double target_frames = target_time * audio->sample_rate;
       ma_decoder_seek_to_pcm_frame(&audio->decoder, target_frames);
-      ma_decoder_read_pcm_frames(&audio->decoder, audio->audio_buffer,
-                                 frame_count, &frames_read);
+      ma_decoder_read_pcm_frames(&audio->decoder, float_output, frame_count,
+                                 &frames_read);
     }
   }
+  return frames_read;
+}
+
+void audio_data_callback(ma_device *device, void *output, const void *input,
+                         ma_uint32 frame_count) {
+  shader_audio *audio = (shader_audio *)device->pUserData;
+  if (!audio)
+    return;
 
-  pthread_mutex_lock(&audio->buffer_mutex);
+  (void)input; // input is not used in playback mode
+
+  // Decode straight into the device buffer, audio_buffer belongs to the
+  // analysis thread
+  float *float_output = (float *)output;
+  ma_uint64 frames_read = decode_frames(audio, float_output, frame_count);
+
+  // Hand the samples to the render thread. This never blocks; if it has
+  // fallen two seconds behind the newest samples are dropped.
+  audio_ring_write(&audio->ring, float_output, frames_read * audio->channels);
+  sem_post(&audio->samples_ready);
+
+  // Fill remainder with silence
+  memset(float_output + frames_read * audio->channels, 0,
+         (frame_count - frames_read) * audio->channels * sizeof(float));
+}
 
-  for (ma_uint32 i = 0; i < frames_read * audio->channels; i++) {
-    audio->circular_buffer[audio->write_pos] = audio->audio_buffer[i];
-    audio->write_pos = (audio->write_pos + 1) % audio->circular_buffer_size;
+// Releases what init_analysis set up, whether or not it got all the way
+static void free_analysis(shader_audio *audio) {
+  if (audio->tex_id) {
+    glDeleteTextures(1, &audio->tex_id);
+    audio->tex_id = 0;
   }
 
-  pthread_mutex_unlock(&audio->buffer_mutex);
+  if (audio->fft_plan)
+    fftwf_destroy_plan(audio->fft_plan);
+  fftwf_free(audio->fft_in);
+  fftwf_free(audio->fft_out);
+  free(audio->window);
 
-  float *float_output = (float *)output;
+  audio_ring_free(&audio->ring);
+  audio_ring_free(&audio->history_queue);
+  free(audio->audio_buffer);
+  for (int i = 0; i < 3; i++)
+    free(audio->rows[i]);
+  free(audio->frequency_smoothed);
+}
+
+// Sets up everything after the source: the ring, FFT, analysis buffers and
+// texture. The channel count and sample rate must be known. Nothing is left
+// allocated on failure.
+static bool init_analysis(shader_audio *audio, int fft_size, int history) {
+  // Setup ring buffer (at least 2 seconds of audio and two FFT windows)
+  size_t ring_frames = (size_t)audio->sample_rate * 2;
+  if (ring_frames < (size_t)fft_size * 2)
+    ring_frames = (size_t)fft_size * 2;
+  if (!audio_ring_init(&audio->ring, ring_frames * audio->channels))
+    goto error;
 
-  // Write to output to create sound
-  for (ma_uint32 i = 0; i < frames_read * audio->channels; i++) {
-    float_output[i] = audio->audio_buffer[i];
+  // Initialize FFT
+  audio->fft_size = fft_size;
+  audio->fft_in = fftwf_malloc(sizeof(float) * fft_size);
+  audio->fft_out = fftwf_malloc(sizeof(fftwf_complex) * (fft_size / 2 + 1));
+  if (!audio->fft_in || !audio->fft_out)
+    goto error;
+  audio->fft_plan = plan_fft(fft_size, audio->fft_in, audio->fft_out);
+  if (!audio->fft_plan) {
+    fprintf(stderr, "Failed to plan a %d point FFT\n", fft_size);
+    goto error;
   }
 
-  // Fill remainder with silence
-  for (ma_uint32 i = frames_read * audio->channels;
-       i < frame_count * audio->channels; i++) {
-    float_output[i] = 0.0f;
+  audio->window = malloc(sizeof(float) * fft_size);
+  if (!audio->window)
+    goto error;
+  audio->window_gain = 0;
+  for (int i = 0; i < fft_size; i++) {
+    audio->window[i] = 0.5f - 0.5f * cosf(2.0f * PI_F * i / (fft_size - 1));
+    audio->window_gain += audio->window[i];
+  }
+
+  // Initialize processing buffers, overlapping windows by half
+  audio->hop_size = fft_size / 2;
+  audio->audio_buffer =
+      calloc((size_t)fft_size * audio->channels, sizeof(float));
+  audio->frequency_smoothed = calloc(AUDIO_TEXTURE_WIDTH, sizeof(float));
+  if (!audio->audio_buffer || !audio->frequency_smoothed)
+    goto error;
+  for (int i = 0; i < 3; i++) {
+    audio->rows[i] = calloc(AUDIO_TEXTURE_SIZE, sizeof(float));
+    if (!audio->rows[i])
+      goto error;
   }
+  audio->rows_back = 0;
+  atomic_init(&audio->rows_middle, 1);
+  audio->rows_front = 2;
+
+  // Spectrum rows on their way from the analysis thread to the history
+  audio->history = history;
+  audio->texture_height = AUDIO_TEXTURE_HEIGHT + history;
+  if (history &&
+      !audio_ring_init(&audio->history_queue,
+                       (size_t)AUDIO_HISTORY_QUEUE * AUDIO_TEXTURE_WIDTH))
+    goto error;
+
+  // Create OpenGL texture, cleared so the history starts out silent
+  float *zeros = calloc((size_t)audio->texture_height * AUDIO_TEXTURE_WIDTH,
+                        sizeof(float));
+  if (!zeros)
+    goto error;
+  glGenTextures(1, &audio->tex_id);
+  glBindTexture(GL_TEXTURE_2D, audio->tex_id);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, AUDIO_TEXTURE_WIDTH,
+               audio->texture_height, 0, GL_RED, GL_FLOAT, zeros);
+  free(zeros);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // Last, so there is never a semaphore to destroy on failure
+  if (sem_init(&audio->samples_ready, 0, 0) != 0) {
+    fprintf(stderr, "Failed to create the audio analysis semaphore\n");
+    goto error;
+  }
+
+  return true;
+
+error:
+  free_analysis(audio);
+  return false;
 }
 
-shader_audio *shader_audio_create(char *path) {
+static void *analysis_thread(void *data);
+static void *silent_thread(void *data);
+
+// A shared source keeps the options of the channel that loaded it first
+static void warn_shared_options(const shader_audio *cur, const char *name,
+                                const shader_channel_options *options) {
+  if (cur->fft_size != options->fft_size)
+    fprintf(stderr,
+            "Audio '%s' is already loaded with fft=%d, ignoring fft=%d\n",
+            name, cur->fft_size, options->fft_size);
+  if (cur->history != options->history)
+    fprintf(stderr,
+            "Audio '%s' is already loaded with history=%d, ignoring "
+            "history=%d\n",
+            name, cur->history, options->history);
+}
+
+void shader_audio_set_muted(bool mute) { muted = mute; }
+
+shader_audio *shader_audio_create(char *path,
+                                  const shader_channel_options *options) {
+  int fft_size = options->fft_size;
   shader_audio *audio = calloc(1, sizeof(shader_audio));
   if (!audio)
     return NULL;
@@ -81,6 +267,29 @@ shader_audio *shader_audio_create(char *path) {
     return NULL;
   }
 
+  // Channels naming the same file, by whatever path, share one player and
+  // analyzer
+  struct stat st;
+  if (stat(path, &st) == 0) {
+    audio->file_device = st.st_dev;
+    audio->file_inode = st.st_ino;
+  }
+  for (shader_audio *cur = sources; cur; cur = cur->next) {
+    if (cur->file_device != audio->file_device ||
+        cur->file_inode != audio->file_inode || !cur->file_inode)
+      continue;
+    warn_shared_options(cur, path, options);
+    // Nothing plays under a fixed clock, so silent does not apply there
+    if (!clock_is_fixed() && cur->silent != (options->silent || muted))
+      fprintf(stderr, "Audio '%s' is already loaded %s, ignoring %s\n", path,
+              cur->silent ? "silent" : "audible",
+              cur->silent ? "audible" : "silent");
+    cur->refs++;
+    free(audio);
+    free(path);
+    return cur;
+  }
+
   // Initialize decoder
   ma_result result = ma_decoder_init_file(path, NULL, &audio->decoder);
   if (result != MA_SUCCESS) {
@@ -119,62 +328,184 @@ shader_audio *shader_audio_create(char *path) {
   }
   audio->duration = (double)length / audio->sample_rate;
 
-  // Setup circular buffer (2 seconds of audio)
-  audio->circular_buffer_size = sampleRate * channels * 2;
-  audio->circular_buffer = calloc(audio->circular_buffer_size, sizeof(float));
-  if (!audio->circular_buffer) {
+  if (!init_analysis(audio, fft_size, options->history)) {
     ma_decoder_uninit(&audio->decoder);
     free(audio);
     return NULL;
   }
 
-  pthread_mutex_init(&audio->buffer_mutex, NULL);
+  audio->refs = 1;
+  audio->next = sources;
+  sources = audio;
 
-  // Initialize FFT
-  audio->fft_in = fftwf_malloc(sizeof(fftwf_complex) * AUDIO_BUFFER_SIZE);
-  audio->fft_out = fftwf_malloc(sizeof(fftwf_complex) * AUDIO_BUFFER_SIZE);
-  audio->fft_plan =
-      fftwf_plan_dft_1d(AUDIO_BUFFER_SIZE, audio->fft_in, audio->fft_out,
-                        FFTW_FORWARD, FFTW_ESTIMATE);
-
-  // Initialize processing buffers
-  audio->audio_buffer = calloc(AUDIO_BUFFER_SIZE * 2, sizeof(float));
-  audio->frequency_data = calloc(AUDIO_TEXTURE_WIDTH, sizeof(float));
-  audio->frequency_smoothed = calloc(AUDIO_TEXTURE_WIDTH, sizeof(float));
-  audio->waveform_data = calloc(AUDIO_TEXTURE_WIDTH, sizeof(float));
+  // A fixed clock renders without playback, reading the decoder directly
+  if (clock_is_fixed())
+    return audio;
 
-  // Create OpenGL texture
-  glGenTextures(1, &audio->tex_id);
-  glBindTexture(GL_TEXTURE_2D, audio->tex_id);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, AUDIO_TEXTURE_WIDTH,
-               AUDIO_TEXTURE_HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  // Initialize audio members
+  audio->start_time = current_time();
+  audio->seek_threshold = 0.5; // Only seek if desynced by more than 500ms
+  audio->silent = options->silent || muted;
+
+  // Silent channels have no device and decode on the analysis thread
+  if (!audio->silent) {
+    ma_device_config config = ma_device_config_init(ma_device_type_playback);
+    config.playback.format = ma_format_f32;
+    config.playback.channels = channels;
+    config.sampleRate = sampleRate;
+    config.dataCallback = audio_data_callback;
+    config.pUserData = audio;
+
+    if (ma_device_init(NULL, &config, &audio->device) != MA_SUCCESS) {
+      fprintf(stderr, "Failed to initialize audio device\n");
+      audio->path = NULL; // Still owned by the caller on failure
+      shader_audio_destroy(audio);
+      return NULL;
+    }
+  }
+  audio->is_playing = true;
 
-  // Configure audio device
-  ma_device_config config = ma_device_config_init(ma_device_type_playback);
-  config.playback.format = ma_format_f32;
-  config.playback.channels = channels;
-  config.sampleRate = sampleRate;
-  config.dataCallback = audio_data_callback;
-  config.pUserData = audio;
+  atomic_init(&audio->analysis_running, true);
+  if (pthread_create(&audio->analysis, NULL,
+                     audio->silent ? silent_thread : analysis_thread,
+                     audio) != 0) {
+    fprintf(stderr, "Failed to start the audio analysis thread\n");
+    audio->path = NULL;
+    shader_audio_destroy(audio);
+    return NULL;
+  }
+  audio->analysis_started = true;
 
-  if (ma_device_init(NULL, &config, &audio->device) != MA_SUCCESS) {
-    fprintf(stderr, "Failed to initialize audio device\n");
+  // Start playback
+  if (!audio->silent && ma_device_start(&audio->device) != MA_SUCCESS) {
+    fprintf(stderr, "Failed to start audio device\n");
+    audio->path = NULL;
     shader_audio_destroy(audio);
     return NULL;
   }
 
-  // Initialize audio members
-  audio->start_time = current_time();
-  audio->seek_threshold = 0.5; // Only seek if desynced by more than 500ms
+  return audio;
+}
+
+static void capture_data_callback(ma_device *device, void *output,
+                                  const void *input, ma_uint32 frame_count) {
+  shader_audio *audio = (shader_audio *)device->pUserData;
+  if (!audio)
+    return;
+
+  (void)output; // output is not used in capture mode
+
+  audio_ring_write(&audio->ring, input, (size_t)frame_count * audio->channels);
+  sem_post(&audio->samples_ready);
+}
+
+// First capture device whose name contains name
+static bool find_capture_device(ma_context *context, const char *name,
+                                ma_device_id *id) {
+  ma_device_info *infos;
+  ma_uint32 count;
+  if (ma_context_get_devices(context, NULL, NULL, &infos, &count) !=
+      MA_SUCCESS)
+    return false;
+
+  for (ma_uint32 i = 0; i < count; i++) {
+    if (strstr(infos[i].name, name)) {
+      *id = infos[i].id;
+      return true;
+    }
+  }
+  return false;
+}
+
+shader_audio *shader_audio_create_capture(
+    char *name, const shader_channel_options *options) {
+  int fft_size = options->fft_size;
+  if (!name)
+    return NULL;
+
+  for (shader_audio *cur = sources; cur; cur = cur->next) {
+    if (!cur->capture || strcmp(cur->path, name) != 0)
+      continue;
+    warn_shared_options(cur, name, options);
+    cur->refs++;
+    free(name);
+    return cur;
+  }
+
+  shader_audio *audio = calloc(1, sizeof(shader_audio));
+  if (!audio)
+    return NULL;
+  audio->path = name;
+  audio->capture = true;
+
+  // "null" captures silence from miniaudio's null backend, which needs no
+  // sound server
+  bool null_backend = strcmp(name, "null") == 0;
+  ma_backend backends[] = {ma_backend_null};
+  if (ma_context_init(null_backend ? backends : NULL, null_backend ? 1 : 0,
+                      NULL, &audio->context) != MA_SUCCESS) {
+    fprintf(stderr, "Failed to initialize the audio context\n");
+    free(audio);
+    return NULL;
+  }
+
+  ma_device_config config = ma_device_config_init(ma_device_type_capture);
+  ma_device_id id;
+  if (!null_backend && strcmp(name, "default") != 0) {
+    if (!find_capture_device(&audio->context, name, &id)) {
+      fprintf(stderr, "No audio capture device matches '%s'\n", name);
+      ma_context_uninit(&audio->context);
+      free(audio);
+      return NULL;
+    }
+    config.capture.pDeviceID = &id;
+  }
+  config.capture.format = ma_format_f32;
+  config.capture.channels = 1; // Analysis mixes down to mono anyway
+  config.sampleRate = 0;       // Whatever the device runs at
+  // Small periods keep the newest samples close to the texture
+  config.periodSizeInMilliseconds = CAPTURE_PERIOD_MS;
+  config.performanceProfile = ma_performance_profile_low_latency;
+  config.dataCallback = capture_data_callback;
+  config.pUserData = audio;
+
+  if (ma_device_init(&audio->context, &config, &audio->device) != MA_SUCCESS) {
+    fprintf(stderr, "Failed to initialize audio capture device '%s'\n", name);
+    ma_context_uninit(&audio->context);
+    free(audio);
+    return NULL;
+  }
+  audio->format = ma_format_f32;
+  audio->channels = audio->device.capture.channels;
+  audio->sample_rate = audio->device.sampleRate;
+
+  if (!init_analysis(audio, fft_size, options->history)) {
+    ma_device_uninit(&audio->device);
+    ma_context_uninit(&audio->context);
+    free(audio);
+    return NULL;
+  }
+  // Windows overlap by three quarters so the spectrum follows the input
+  // closely; only the newest one is analyzed
+  audio->hop_size = fft_size / 4;
+
+  audio->refs = 1;
+  audio->next = sources;
+  sources = audio;
   audio->is_playing = true;
 
-  // Start playback
+  atomic_init(&audio->analysis_running, true);
+  if (pthread_create(&audio->analysis, NULL, analysis_thread, audio) != 0) {
+    fprintf(stderr, "Failed to start the audio analysis thread\n");
+    audio->path = NULL; // Still owned by the caller on failure
+    shader_audio_destroy(audio);
+    return NULL;
+  }
+  audio->analysis_started = true;
+
   if (ma_device_start(&audio->device) != MA_SUCCESS) {
-    fprintf(stderr, "Failed to start audio device\n");
+    fprintf(stderr, "Failed to start audio capture device '%s'\n", name);
+    audio->path = NULL;
     shader_audio_destroy(audio);
     return NULL;
   }
@@ -182,129 +513,269 @@ shader_audio *shader_audio_create(char *path) {
   return audio;
 }
 
-void shader_audio_update(shader_audio *audio, struct timespec start_time) {
-  if (!audio || !audio->is_playing)
-    return;
+// Turns the fft_size frames in audio_buffer into the waveform and spectrum
+// rows of the texture, written to rows
+static void analyze_audio_buffer(shader_audio *audio, float *rows);
 
-  audio->start_time = start_time;
+static void upload_rows(shader_audio *audio, const float *rows) {
+  glBindTexture(GL_TEXTURE_2D, audio->tex_id);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, AUDIO_TEXTURE_WIDTH,
+                  AUDIO_TEXTURE_HEIGHT, GL_RED, GL_FLOAT, rows);
+}
 
-  pthread_mutex_lock(&audio->buffer_mutex);
+// Overwrites the oldest history row with spectrum, which becomes the newest
+static void upload_history_row(shader_audio *audio, const float *spectrum) {
+  audio->history_row = (audio->history_row + 1) % audio->history;
+  glBindTexture(GL_TEXTURE_2D, audio->tex_id);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0,
+                  AUDIO_TEXTURE_HEIGHT + audio->history_row,
+                  AUDIO_TEXTURE_WIDTH, 1, GL_RED, GL_FLOAT, spectrum);
+}
 
-  // Calculate available samples
-  size_t available;
-  if (audio->write_pos >= audio->read_pos) {
-    available = audio->write_pos - audio->read_pos;
-  } else {
-    available =
-        (audio->circular_buffer_size - audio->read_pos) + audio->write_pos;
+// Uploads the spectrum rows the analysis thread queued since the last frame.
+// Rows that would be overwritten in the same frame are skipped.
+static void drain_history(shader_audio *audio) {
+  float spectrum[AUDIO_TEXTURE_WIDTH];
+  size_t pending =
+      audio_ring_available(&audio->history_queue) / AUDIO_TEXTURE_WIDTH;
+  for (size_t i = 0; i < pending; i++) {
+    audio_ring_read(&audio->history_queue, spectrum, AUDIO_TEXTURE_WIDTH);
+    if (pending - i <= (size_t)audio->history)
+      upload_history_row(audio, spectrum);
   }
+}
 
-  // Need at least AUDIO_BUFFER_SIZE * channels samples
-  if (available < AUDIO_BUFFER_SIZE * audio->channels) {
-    pthread_mutex_unlock(&audio->buffer_mutex);
-    return;
+// Drops the oldest hop from the analysis window, returning where the next
+// hop_size frames go
+static float *advance_window(shader_audio *audio) {
+  size_t hop_samples = (size_t)audio->hop_size * audio->channels;
+  size_t keep_samples = (size_t)audio->fft_size * audio->channels - hop_samples;
+  memmove(audio->audio_buffer, audio->audio_buffer + hop_samples,
+          keep_samples * sizeof(float));
+  return audio->audio_buffer + keep_samples;
+}
+
+static void analyze_and_publish(shader_audio *audio) {
+  analyze_audio_buffer(audio, audio->rows[audio->rows_back]);
+
+  // Every hop adds a history row, not only those the renderer picks up
+  if (audio->history)
+    audio_ring_write(&audio->history_queue,
+                     audio->rows[audio->rows_back] + AUDIO_TEXTURE_WIDTH,
+                     AUDIO_TEXTURE_WIDTH);
+
+  // Swap the finished rows into the middle slot, marked fresh, and keep
+  // working on whatever the renderer left there
+  unsigned previous =
+      atomic_exchange(&audio->rows_middle, audio->rows_back | ROWS_FRESH);
+  audio->rows_back = previous & ~ROWS_FRESH;
+}
+
+// Analysis thread: slide the window along the ring one hop at a time and
+// publish each result through the triple buffer
+static void *analysis_thread(void *data) {
+  shader_audio *audio = data;
+  size_t hop_samples = (size_t)audio->hop_size * audio->channels;
+
+  while (atomic_load(&audio->analysis_running)) {
+    sem_wait(&audio->samples_ready);
+
+    // Capture only shows the newest window, older hops just slide through
+    size_t hops = audio_ring_available(&audio->ring) / hop_samples;
+    for (size_t i = 0; i < hops; i++) {
+      audio_ring_read(&audio->ring, advance_window(audio), hop_samples);
+      if (!audio->capture || i == hops - 1)
+        analyze_and_publish(audio);
+    }
   }
+  return NULL;
+}
+
+// Frames of audio the frame clock has advanced through since start_time
+static int64_t clock_frames(shader_audio *audio) {
+  return (int64_t)(time_elapsed(audio->start_time) * audio->sample_rate);
+}
 
-  // Copy samples to processing buffer
-  for (ma_uint32 i = 0; i < AUDIO_BUFFER_SIZE * audio->channels; i++) {
-    audio->audio_buffer[i] = audio->circular_buffer[audio->read_pos];
-    audio->read_pos = (audio->read_pos + 1) % audio->circular_buffer_size;
+// Silent channels have no device to pull samples, so on each wakeup decode
+// every hop the frame clock has passed and sleep until the next one is due.
+// Pacing by start_time keeps the channel on iTime, however late the thread
+// started or long it was suspended.
+static void *silent_thread(void *data) {
+  shader_audio *audio = data;
+  // Start a window back, so the first wakeup fills the whole window
+  int64_t decoded = clock_frames(audio) - audio->fft_size;
+
+  while (atomic_load(&audio->analysis_running)) {
+    int64_t target = clock_frames(audio);
+    // Only the newest window is analyzed, skip whatever came before it. Also
+    // covers start_time moving backwards, so the wait below stays short.
+    if (target - decoded > audio->fft_size || decoded > target)
+      decoded = target - audio->fft_size;
+
+    for (; target - decoded >= audio->hop_size; decoded += audio->hop_size) {
+      float *hop = advance_window(audio);
+      ma_uint64 frames_read = decode_frames(audio, hop, audio->hop_size);
+      memset(hop + frames_read * audio->channels, 0,
+             (audio->hop_size - frames_read) * audio->channels *
+                 sizeof(float));
+      analyze_and_publish(audio);
+    }
+
+    int64_t due = decoded + audio->hop_size;
+    int64_t due_ns = timespec_to_ns(audio->start_time) +
+                     due * 1000000000 / audio->sample_rate;
+    struct timespec wake = ns_to_timespec(due_ns);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
   }
+  return NULL;
+}
 
-  pthread_mutex_unlock(&audio->buffer_mutex);
+// Fixed clock: decode the window that ends at the current time straight from
+// the file, so each frame sees the same samples on every run
+static void step_audio(shader_audio *audio, struct timespec start_time) {
+  // Shared channels are updated once per reference, decode only once
+  double elapsed = time_elapsed(start_time);
+  if (audio->stepped && audio->step_time == elapsed)
+    return;
+  audio->stepped = true;
+  audio->step_time = elapsed;
+
+  double target_time = fmod(elapsed, audio->duration);
+  ma_int64 end = (ma_int64)(target_time * audio->sample_rate);
+  ma_int64 first = end - audio->fft_size;
+
+  memset(audio->audio_buffer, 0,
+         (size_t)audio->fft_size * audio->channels * sizeof(float));
+  ma_uint64 skip = first < 0 ? -first : 0;
+  ma_uint64 frames_read = 0;
+  ma_decoder_seek_to_pcm_frame(&audio->decoder, first < 0 ? 0 : first);
+  ma_decoder_read_pcm_frames(&audio->decoder,
+                             audio->audio_buffer + skip * audio->channels,
+                             audio->fft_size - skip, &frames_read);
+
+  analyze_audio_buffer(audio, audio->rows[audio->rows_front]);
+  upload_rows(audio, audio->rows[audio->rows_front]);
+  if (audio->history)
+    upload_history_row(audio,
+                       audio->rows[audio->rows_front] + AUDIO_TEXTURE_WIDTH);
+}
+
+void shader_audio_update(shader_audio *audio, struct timespec start_time) {
+  if (!audio)
+    return;
 
-  // Process waveform data
+  if (clock_is_fixed() && !audio->capture) {
+    step_audio(audio, start_time);
+    return;
+  }
+  if (!audio->is_playing)
+    return;
+
+  audio->start_time = start_time;
+
+  if (audio->history)
+    drain_history(audio);
+
+  // Nothing new since the last upload
+  if (!(atomic_load(&audio->rows_middle) & ROWS_FRESH))
+    return;
+
+  unsigned latest = atomic_exchange(&audio->rows_middle, audio->rows_front);
+  audio->rows_front = latest & ~ROWS_FRESH;
+  upload_rows(audio, audio->rows[audio->rows_front]);
+}
+
+static void analyze_audio_buffer(shader_audio *audio, float *rows) {
+  // Waveform (first row)
+  int fft_size = audio->fft_size;
   for (int i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
-    int idx = (i * AUDIO_BUFFER_SIZE) / AUDIO_TEXTURE_WIDTH;
+    int idx = (i * fft_size) / AUDIO_TEXTURE_WIDTH;
     if (audio->channels == 2) {
-      audio->waveform_data[i] =
+      rows[i] =
           (audio->audio_buffer[idx * 2] + audio->audio_buffer[idx * 2 + 1]) *
           0.5f;
     } else {
-      audio->waveform_data[i] = audio->audio_buffer[idx];
+      rows[i] = audio->audio_buffer[idx];
     }
   }
 
-  // Prepare FFT input (convert to mono)
-  for (int i = 0; i < AUDIO_BUFFER_SIZE; i++) {
+  // Prepare FFT input (convert to mono and apply the window)
+  for (int i = 0; i < fft_size; i++) {
+    float mono;
     if (audio->channels == 2) {
-      float mono =
+      mono =
           (audio->audio_buffer[i * 2] + audio->audio_buffer[i * 2 + 1]) * 0.5f;
-      audio->fft_in[i][0] = mono;
-      audio->fft_in[i][1] = 0;
     } else {
-      audio->fft_in[i][0] = audio->audio_buffer[i];
-      audio->fft_in[i][1] = 0;
+      mono = audio->audio_buffer[i];
     }
+    audio->fft_in[i] = mono * audio->window[i];
   }
 
   // Execute FFT
   fftwf_execute(audio->fft_plan);
 
-  // Process frequency data
+  // Spectrum (second row), each texel averaging the bins it covers
+  float *spectrum = rows + AUDIO_TEXTURE_WIDTH;
+  int bins = fft_size / 2;
   for (int i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
-    int bin = (i * (AUDIO_BUFFER_SIZE / 2)) / AUDIO_TEXTURE_WIDTH;
-    float real = audio->fft_out[bin][0];
-    float imag = audio->fft_out[bin][1];
-    float magnitude =
-        sqrtf(real * real + imag * imag) / (AUDIO_BUFFER_SIZE / 2.0);
+    int first = (i * bins) / AUDIO_TEXTURE_WIDTH;
+    int last = ((i + 1) * bins) / AUDIO_TEXTURE_WIDTH;
+    if (last <= first)
+      last = first + 1;
+
+    float sum = 0;
+    for (int bin = first; bin < last; bin++) {
+      float real = audio->fft_out[bin][0];
+      float imag = audio->fft_out[bin][1];
+      sum += sqrtf(real * real + imag * imag);
+    }
+    // A full-scale sine peaks at 1 whatever the size and window
+    float magnitude = sum / (last - first) * 2.0f / audio->window_gain;
 
     // Apply logarithmic scale
     magnitude = logf(1.0f + magnitude * 10.0f);
 
     // Smooth with exponential moving average
-    audio->frequency_data[i] =
-        audio->frequency_smoothed[i] * 0.9f + magnitude * 0.1f;
-    audio->frequency_smoothed[i] = audio->frequency_data[i];
+    spectrum[i] = audio->frequency_smoothed[i] * 0.9f + magnitude * 0.1f;
+    audio->frequency_smoothed[i] = spectrum[i];
   }
-
-  // Update texture
-  float texture_data[AUDIO_TEXTURE_WIDTH * AUDIO_TEXTURE_HEIGHT];
-
-  // Waveform (first row)
-  for (int i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
-    texture_data[i] = audio->waveform_data[i];
-  }
-
-  // Spectrum (second row)
-  int offset = AUDIO_TEXTURE_WIDTH;
-  for (int i = 0; i < AUDIO_TEXTURE_WIDTH; i++) {
-    texture_data[offset + i] = audio->frequency_data[i];
-  }
-
-  glBindTexture(GL_TEXTURE_2D, audio->tex_id);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, AUDIO_TEXTURE_WIDTH,
-                  AUDIO_TEXTURE_HEIGHT, GL_RED, GL_FLOAT, texture_data);
 }
 
 void shader_audio_destroy(shader_audio *audio) {
   if (!audio)
     return;
 
+  // Released by every channel that shares it
+  if (--audio->refs > 0)
+    return;
+  for (shader_audio **cur = &sources; *cur; cur = &(*cur)->next) {
+    if (*cur == audio) {
+      *cur = audio->next;
+      break;
+    }
+  }
+
   free(audio->path);
   audio->path = NULL;
 
-  if (audio->is_playing) {
+  if (audio->is_playing && !audio->silent) {
     ma_device_stop(&audio->device);
     ma_device_uninit(&audio->device);
   }
 
-  ma_decoder_uninit(&audio->decoder);
-
-  if (audio->tex_id) {
-    glDeleteTextures(1, &audio->tex_id);
+  // The callback has stopped posting, wake the thread one last time to exit
+  if (audio->analysis_started) {
+    atomic_store(&audio->analysis_running, false);
+    sem_post(&audio->samples_ready);
+    pthread_join(audio->analysis, NULL);
   }
+  sem_destroy(&audio->samples_ready);
 
-  fftwf_destroy_plan(audio->fft_plan);
-  fftwf_free(audio->fft_in);
-  fftwf_free(audio->fft_out);
-
-  pthread_mutex_destroy(&audio->buffer_mutex);
+  if (audio->capture)
+    ma_context_uninit(&audio->context);
+  else
+    ma_decoder_uninit(&audio->decoder);
 
-  free(audio->circular_buffer);
-  free(audio->audio_buffer);
-  free(audio->waveform_data);
-  free(audio->frequency_data);
-  free(audio->frequency_smoothed);
+  free_analysis(audio);
   free(audio);
 }
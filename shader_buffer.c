@@ -1,4 +1,7 @@
 #include "shader_buffer.h"
+#include "gl_state.h"
+#include "gpu_timer.h"
+#include "render_graph.h"
 #include "shader.h"
 #include "shader_audio.h"
 #include "shader_channel.h"
@@ -7,73 +10,76 @@
 #include "shader_video.h"
 #include "util.h"
 #include <GLES3/gl3.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// All of these are color-renderable in OpenGL ES 3.2
+static const buffer_format BUFFER_FORMATS[] = {
+    {"rgba32f", GL_RGBA32F, GL_RGBA, GL_FLOAT},
+    {"rgba16f", GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT},
+    {"rgba8", GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE},
+    {"rgb10a2", GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV},
+    {"rg32f", GL_RG32F, GL_RG, GL_FLOAT},
+    {"rg16f", GL_RG16F, GL_RG, GL_HALF_FLOAT},
+    {"r32f", GL_R32F, GL_RED, GL_FLOAT},
+    {"r16f", GL_R16F, GL_RED, GL_HALF_FLOAT},
+    {"r8", GL_R8, GL_RED, GL_UNSIGNED_BYTE},
+};
+
+#define BUFFER_FORMAT_COUNT (sizeof(BUFFER_FORMATS) / sizeof(*BUFFER_FORMATS))
+
+const buffer_format *find_buffer_format(const char *name) {
+  for (size_t i = 0; i < BUFFER_FORMAT_COUNT; i++) {
+    if (strcmp(BUFFER_FORMATS[i].name, name) == 0)
+      return &BUFFER_FORMATS[i];
+  }
+  return NULL;
+}
+
+// Full float precision, matching what existing pipelines were written for
+const buffer_format *default_buffer_format() { return &BUFFER_FORMATS[0]; }
+
+// Always renderable fallback
+static const buffer_format *fallback_buffer_format() {
+  return find_buffer_format("rgba8");
+}
+
 void free_shader_buffer(shader_buffer *buf) {
   if (!buf)
     return;
 
+  cancel_program(buf->build);
+  cancel_program(buf->reload);
   if (buf->program)
     glDeleteProgram(buf->program);
-  if (buf->fbo)
-    glDeleteFramebuffers(1, &buf->fbo);
-  if (buf->textures[0] || buf->textures[1])
-    glDeleteTextures(2, buf->textures);
   free(buf->u);
   free(buf->shader_path);
   free(buf);
 }
 
-bool init_shader_buffer(shader_buffer *buf, int width, int height,
-                        char *shared_shader_path) {
+bool init_shader_buffer(shader_buffer *buf, char *shared_shader_path) {
   if (!buf)
     return false;
 
-  buf->width = width;
-  buf->height = height;
-  buf->frame = 0;
-  buf->last_time = 0;
-  buf->render_parity = 0;
-
-  if (!compile_and_link_program(&buf->program, buf->shader_path,
-                                shared_shader_path)) {
+  // Only submitted here; the program and its uniform locations are collected
+  // once the driver has finished building it
+  buf->build = submit_program(buf->shader_path, shared_shader_path);
+  if (!buf->build) {
     return false;
   }
 
-  // Create FBO and textures
-  glGenFramebuffers(1, &buf->fbo);
-  glGenTextures(2, buf->textures);
-  for (int i = 0; i < 2; i++) {
-    glBindTexture(GL_TEXTURE_2D, buf->textures[i]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA,
-                 GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  }
-
-  // Attach first texture to FBO
-  glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         buf->textures[0], 0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  buf->current_texture = 0;
-
   // Initialize buffer uniforms
   buf->u = malloc(sizeof(shader_uniform));
   if (!buf->u) {
     return false;
   }
-  set_uniform_locations(buf->program, buf->u);
 
   // Initialize buffer channels
   for (int i = 0; i < 10; i++) {
     if (!buf->channel[i])
       continue;
-    if (!init_channel_recursive(buf->channel[i], width, height,
-                                shared_shader_path)) {
+    if (!init_channel_recursive(buf->channel[i], shared_shader_path)) {
       return false;
     }
   }
@@ -81,51 +87,158 @@ bool init_shader_buffer(shader_buffer *buf, int width, int height,
   return true;
 }
 
-void render_shader_buffer(shader_context *ctx, shader_buffer *buf,
-                          struct timespec start_time, iMouse *mouse) {
-  if (!ctx || !buf)
+static void allocate_target_textures(shader_target *target,
+                                     const buffer_format *format) {
+  for (int i = 0; i < target->texture_count; i++) {
+    glBindTexture(GL_TEXTURE_2D, target->textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, format->internal_format, target->width,
+                 target->height, 0, format->format, format->type, NULL);
+  }
+}
+
+static bool target_complete(shader_target *target) {
+  for (int i = 0; i < target->texture_count; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo[i]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      return false;
+  }
+  return true;
+}
+
+// Start every texture out black so the first frames of feedback buffers and
+// offscreen renders never read undefined memory
+static void clear_target_textures(shader_target *target) {
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < target->texture_count; i++) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo[i]);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+// Size of a buffer's target for an output of the given size
+static void scaled_size(shader_buffer *buf, int width, int height,
+                        int *scaled_width, int *scaled_height) {
+  *scaled_width = (int)(width * buf->scale + 0.5f);
+  *scaled_height = (int)(height * buf->scale + 0.5f);
+  if (*scaled_width < 1)
+    *scaled_width = 1;
+  if (*scaled_height < 1)
+    *scaled_height = 1;
+}
+
+bool init_shader_target(shader_target *target, render_pass *pass, int width,
+                        int height, bool window) {
+  if (!target || !pass)
+    return false;
+
+  shader_buffer *buf = pass->buf;
+  scaled_size(buf, width, height, &target->width, &target->height);
+  target->current_texture = 0;
+
+  // Draw straight into the window surface, nothing to allocate
+  if (window) {
+    target->texture_count = 0;
+    return true;
+  }
+
+  // Only buffers whose previous frame is sampled need a second texture
+  target->texture_count = pass->feedback_source ? 2 : 1;
+
+  // Create one FBO per texture so attachments never change while rendering
+  glGenFramebuffers(target->texture_count, target->fbo);
+  glGenTextures(target->texture_count, target->textures);
+  allocate_target_textures(target, buf->format);
+  for (int i = 0; i < target->texture_count; i++) {
+    glBindTexture(GL_TEXTURE_2D, target->textures[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           target->textures[i], 0);
+  }
+
+  // Make sure the driver can actually render to the requested format
+  if (!target_complete(target) && buf->format != fallback_buffer_format()) {
+    fprintf(stderr,
+            "Buffer format '%s' is not renderable for '%s', falling back to "
+            "'%s'\n",
+            buf->format->name, buf->shader_path,
+            fallback_buffer_format()->name);
+    buf->format = fallback_buffer_format();
+    allocate_target_textures(target, buf->format);
+  }
+  if (!target_complete(target)) {
+    fprintf(stderr, "Framebuffer for buffer '%s' is not complete\n",
+            buf->shader_path);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return false;
+  }
+  clear_target_textures(target);
+
+  return true;
+}
+
+void resize_shader_target(shader_target *target, render_pass *pass, int width,
+                          int height) {
+  if (!target || !pass)
     return;
 
-  // Flip parity so we don't re-render same buffer multiple times this frame
-  buf->render_parity = !buf->render_parity;
+  scaled_size(pass->buf, width, height, &width, &height);
+  if (target->width == width && target->height == height)
+    return;
 
-  // First: recursively render any buffer inputs / update media
-  for (int i = 0; i < 10; i++) {
-    if (!buf->channel[i])
-      continue;
-    switch (buf->channel[i]->type) {
-    case BUFFER:
-      // Avoid re-rendering buffers that were already rendered this frame
-      if (buf->channel[i]->buf->render_parity == buf->render_parity)
-        break;
-      render_shader_buffer(ctx, buf->channel[i]->buf, start_time, mouse);
-      break;
-    case VIDEO:
-      shader_video_update(buf->channel[i]->vid, start_time);
-      shader_video_render(buf->channel[i]->vid);
-      break;
-    case AUDIO:
-      shader_audio_update(buf->channel[i]->aud, start_time);
-      break;
-    default:
-      break;
-    }
+  target->width = width;
+  target->height = height;
+  allocate_target_textures(target, pass->buf->format);
+  clear_target_textures(target);
+}
+
+void free_shader_target(shader_target *target) {
+  if (!target)
+    return;
+
+  if (target->texture_count) {
+    glDeleteFramebuffers(target->texture_count, target->fbo);
+    glDeleteTextures(target->texture_count, target->textures);
   }
+  target->texture_count = 0;
+}
 
-  // Ping-pong: we'll read from prev_tex and write to next_tex
-  int prev_tex = buf->current_texture;
-  int next_tex = 1 - buf->current_texture;
+// Inputs of the pass were rendered by earlier passes of the graph
+void render_shader_buffer(shader_surface *surface, render_pass *pass) {
+  if (!surface || !pass)
+    return;
+
+  shader_context *ctx = surface->ctx;
+  shader_buffer *buf = pass->buf;
+  shader_target *target = &surface->targets[buf->index];
 
-  // Bind FBO and attach the texture we will render into (next_tex)
-  glBindFramebuffer(GL_FRAMEBUFFER, buf->fbo);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         buf->textures[next_tex], 0);
+  gpu_timer *timer = surface->pass_timers ? surface->pass_timers[buf->index]
+                                          : NULL;
+  gpu_timer_begin(timer);
+
+  // Ping-pong: the current texture keeps the previous frame for feedback
+  // readers while we write to next_tex. Single-buffered targets always
+  // render into their only texture, window targets into the default
+  // framebuffer.
+  int next_tex = 0;
+  if (target->texture_count > 0) {
+    next_tex = (target->current_texture + 1) % target->texture_count;
+    gl_bind_framebuffer(target->fbo[next_tex]);
+  } else {
+    gl_bind_framebuffer(0);
+  }
 
   // Use program and viewport
-  glUseProgram(buf->program);
-  glViewport(0, 0, buf->width, buf->height);
+  gl_use_program(buf->program);
+  gl_viewport(0, 0, target->width, target->height);
 
-  // Bind channels as iChannel0..iChannel9 (texture units 0..9)
+  // Bind channels as iChannel0..iChannel9 (texture units 0..9). The sampler
+  // uniforms were pointed at those units when the program was linked.
   for (int i = 0; i < 10; i++) {
     if (!buf->channel[i])
       continue;
@@ -133,16 +246,14 @@ void render_shader_buffer(shader_context *ctx, shader_buffer *buf,
     GLuint tex_id = 0;
 
     switch (buf->channel[i]->type) {
-    case BUFFER:
-      if (buf->channel[i]->buf == buf) {
-        // Self-feedback: bind last frame's texture
-        tex_id = buf->textures[prev_tex];
-      } else {
-        // Other buffer: bind its most-recent texture
-        shader_buffer *other = buf->channel[i]->buf;
-        tex_id = other->textures[other->current_texture];
-      }
+    case BUFFER: {
+      // Dependencies were rendered earlier this frame, so their current
+      // texture is fresh. Feedback sources (including this buffer) have not
+      // rendered yet, so their current texture holds the previous frame.
+      shader_target *source = &surface->targets[pass->source[i]];
+      tex_id = source->textures[source->current_texture];
       break;
+    }
     case TEXTURE:
       tex_id = buf->channel[i]->tex->tex_id;
       break;
@@ -161,30 +272,19 @@ void render_shader_buffer(shader_context *ctx, shader_buffer *buf,
       continue;
 
     // Bind to texture unit i
-    glActiveTexture(GL_TEXTURE0 + i);
-    glBindTexture(GL_TEXTURE_2D, tex_id);
-
-    // Set the shader sampler uniform (iChannelN)
-    if (buf->u->channel[i] >= 0) {
-      glUniform1i(buf->u->channel[i], i);
-    }
+    gl_bind_texture_unit(i, tex_id);
   }
 
-  // Also set any other uniforms (iTime, iResolution, mouse, frame, etc.)
-  // set_uniforms should set uniforms that aren't channel samplers.
-  set_uniforms(buf, start_time, mouse);
+  // Point the pass block at this pass's iResolution, iMouse and channel info
+  bind_pass_uniforms(surface, pass);
 
   // Draw
-  glBindVertexArray(ctx->vao);
+  gl_bind_vertex_array(ctx->vao);
   glDrawArrays(GL_TRIANGLES, 0, 3);
+  gl_count_call();
 
-  // Unbind FBO so subsequent rendering goes to default framebuffer
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  gpu_timer_end(timer);
 
   // Swap: the texture we just rendered into becomes the current output
-  buf->current_texture = next_tex;
-
-  // Update state for next frame
-  buf->last_time = time_elapsed(start_time);
-  buf->frame++;
+  target->current_texture = next_tex;
 }
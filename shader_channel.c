@@ -20,6 +20,80 @@ static void skip_whitespace(const char *input, int *pos) {
   }
 }
 
+// Parse a `[key=value,...]` option list, *pos pointing at the '['
+static void parse_options(const char *input, int *pos,
+                          shader_channel_type type,
+                          shader_channel_options *options) {
+  (*pos)++; // Skip '['
+  while (input[*pos] && input[*pos] != ']') {
+    int key_start = *pos;
+    while (input[*pos] && input[*pos] != '=' && input[*pos] != ',' &&
+           input[*pos] != ']') {
+      (*pos)++;
+    }
+    char *key = strndup(input + key_start, *pos - key_start);
+
+    char *value = NULL;
+    if (input[*pos] == '=') {
+      (*pos)++; // Skip '='
+      int value_start = *pos;
+      while (input[*pos] && input[*pos] != ',' && input[*pos] != ']') {
+        (*pos)++;
+      }
+      value = strndup(input + value_start, *pos - value_start);
+    }
+
+    if (strcmp(key, "scale") == 0 && type == BUFFER && value) {
+      options->scale = atof(value);
+      if (options->scale <= 0) {
+        fprintf(stderr, "Error: Buffer scale must be a number >0\n");
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(key, "format") == 0 && type == BUFFER && value) {
+      options->format = find_buffer_format(value);
+      if (!options->format) {
+        fprintf(stderr, "Error: Unknown buffer format '%s'\n", value);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(key, "fft") == 0 && type == AUDIO && value) {
+      options->fft_size = atoi(value);
+      if (options->fft_size < AUDIO_FFT_MIN ||
+          options->fft_size > AUDIO_FFT_MAX ||
+          (options->fft_size & (options->fft_size - 1))) {
+        fprintf(stderr,
+                "Error: Audio FFT size must be a power of two from %d to %d\n",
+                AUDIO_FFT_MIN, AUDIO_FFT_MAX);
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(key, "silent") == 0 && type == AUDIO && !value) {
+      options->silent = true;
+    } else if (strcmp(key, "capture") == 0 && type == AUDIO && !value) {
+      options->capture = true;
+    } else if (strcmp(key, "history") == 0 && type == AUDIO && value) {
+      options->history = atoi(value);
+      if (options->history < 1 || options->history > AUDIO_HISTORY_MAX) {
+        fprintf(stderr, "Error: Audio history must be from 1 to %d rows\n",
+                AUDIO_HISTORY_MAX);
+        exit(EXIT_FAILURE);
+      }
+    } else {
+      fprintf(stderr, "Error: Invalid resource option '%s'\n", key);
+      exit(EXIT_FAILURE);
+    }
+
+    free(key);
+    free(value);
+    if (input[*pos] == ',')
+      (*pos)++;
+  }
+
+  if (input[*pos] != ']') {
+    fprintf(stderr, "Error: Unterminated resource options\n");
+    exit(EXIT_FAILURE);
+  }
+  (*pos)++; // Skip ']'
+}
+
 // Function to parse a token
 shader_channel *parse_token(const char *input, int *pos,
                             resource_registry **registry) {
@@ -93,13 +167,21 @@ shader_channel *parse_token(const char *input, int *pos,
   // Parse name (or empty for anonymous)
   int name_start = *pos;
   while (input[*pos] && !isspace(input[*pos]) && input[*pos] != ':' &&
-         input[*pos] != ')') {
+         input[*pos] != ')' && input[*pos] != '[') {
     (*pos)++;
   }
   int name_len = *pos - name_start;
   char *name =
       name_len > 0 ? strndup(input + name_start, name_len) : strdup("");
 
+  // Parse options (only meaningful on definitions)
+  shader_channel_options options = {.scale = 1,
+                                    .format = default_buffer_format(),
+                                    .fft_size = AUDIO_BUFFER_SIZE};
+  bool has_options = input[*pos] == '[';
+  if (has_options)
+    parse_options(input, pos, type, &options);
+
   // Handle definition (with colon) or reference (without colon)
   shader_channel *channel = NULL;
   if (input[*pos] == ':') {
@@ -121,6 +203,8 @@ shader_channel *parse_token(const char *input, int *pos,
     case BUFFER:
       channel->buf = calloc(1, sizeof(shader_buffer));
       channel->buf->shader_path = path;
+      channel->buf->scale = options.scale;
+      channel->buf->format = options.format;
       break;
     case TEXTURE:
       channel->tex = malloc(sizeof(shader_texture));
@@ -136,7 +220,9 @@ shader_channel *parse_token(const char *input, int *pos,
       }
       break;
     case AUDIO:
-      channel->aud = shader_audio_create(path);
+      channel->aud = options.capture
+                         ? shader_audio_create_capture(path, &options)
+                         : shader_audio_create(path, &options);
       if (!channel->aud) {
         fprintf(stderr, "Failed to create audio channel from '%s'\n", path);
         free(channel);
@@ -164,6 +250,11 @@ shader_channel *parse_token(const char *input, int *pos,
       fprintf(stderr, "Error: Reference must include a name\n");
       exit(EXIT_FAILURE);
     }
+    if (has_options) {
+      fprintf(stderr, "Error: Options can only be set where '%s' is defined\n",
+              name);
+      exit(EXIT_FAILURE);
+    }
     resource_registry *existing_registry =
         registry_lookup(*registry, name, type);
     if (!existing_registry) {
@@ -230,8 +321,7 @@ void free_shader_channel(shader_channel *channel) {
   free(channel);
 }
 
-bool init_channel_recursive(shader_channel *channel, int width, int height,
-                            char *shared_shader_path) {
+bool init_channel_recursive(shader_channel *channel, char *shared_shader_path) {
   if (!channel)
     return false;
 
@@ -241,7 +331,7 @@ bool init_channel_recursive(shader_channel *channel, int width, int height,
 
   switch (channel->type) {
   case BUFFER:
-    if (!init_shader_buffer(channel->buf, width, height, shared_shader_path)) {
+    if (!init_shader_buffer(channel->buf, shared_shader_path)) {
       return false;
     }
     break;
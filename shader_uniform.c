@@ -1,4 +1,7 @@
 #include "shader_uniform.h"
+#include "gl_state.h"
+#include "render_graph.h"
+#include "shader.h"
 #include "shader_audio.h"
 #include "shader_buffer.h"
 #include "shader_channel.h"
@@ -6,124 +9,196 @@
 #include "shader_video.h"
 #include "util.h"
 #include <GLES3/gl3.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 void set_uniform_locations(GLuint program, shader_uniform *u) {
-  // Get uniform locations
-  u->resolution = glGetUniformLocation(program, "iResolution");
-  u->time = glGetUniformLocation(program, "iTime");
-  u->time_delta = glGetUniformLocation(program, "iTimeDelta");
-  u->frame = glGetUniformLocation(program, "iFrame");
-  u->frame_rate = glGetUniformLocation(program, "iFrameRate");
-  u->mouse = glGetUniformLocation(program, "iMouse");
-  u->mouse_pos = glGetUniformLocation(program, "iMousePos");
-  u->date = glGetUniformLocation(program, "iDate");
-
-  // Get uniform locations for iChannel0-9
+  // Attach the uniform blocks to their shared binding points. Blocks the
+  // shader never reads may be optimized out.
+  GLuint frame_block = glGetUniformBlockIndex(program, "WlsbgFrame");
+  if (frame_block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, frame_block, FRAME_UNIFORM_BINDING);
+  GLuint pass_block = glGetUniformBlockIndex(program, "WlsbgPass");
+  if (pass_block != GL_INVALID_INDEX)
+    glUniformBlockBinding(program, pass_block, PASS_UNIFORM_BINDING);
+
+  // Get uniform locations for iChannel0-9 and bind each to its fixed texture
+  // unit once, so rendering never has to touch sampler uniforms
+  glUseProgram(program);
   for (int i = 0; i < 10; i++) {
     char name[16];
     snprintf(name, sizeof(name), "iChannel%d", i);
     u->channel[i] = glGetUniformLocation(program, name);
+    if (u->channel[i] >= 0)
+      glUniform1i(u->channel[i], i);
   }
+  glUseProgram(0);
+  gl_state_invalidate();
+}
 
-  // Get channel resolution uniforms
-  for (int i = 0; i < 10; i++) {
-    char name[32];
-    snprintf(name, sizeof(name), "iChannelResolution[%d]", i);
-    u->channel_res[i] = glGetUniformLocation(program, name);
-  }
+// Offsets of the pass blocks must honour the driver's binding alignment
+static size_t pass_offset(shader_surface *surface, int pass) {
+  return surface->pass_uniform_offset + pass * surface->pass_uniform_stride;
+}
 
-  // Get channel duration uniforms
-  for (int i = 0; i < 10; i++) {
-    char name[32];
-    snprintf(name, sizeof(name), "iChannelDuration[%d]", i);
-    u->channel_dur[i] = glGetUniformLocation(program, name);
-  }
+bool init_uniform_buffer(shader_surface *surface) {
+  GLint alignment;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  if (alignment < 1)
+    alignment = 1;
+
+  surface->pass_uniform_offset =
+      (sizeof(frame_uniforms) + alignment - 1) / alignment * alignment;
+  surface->pass_uniform_stride =
+      (sizeof(pass_uniforms) + alignment - 1) / alignment * alignment;
+  surface->uniform_size =
+      pass_offset(surface, surface->ctx->graph->pass_count);
+
+  surface->uniform_data = calloc(1, surface->uniform_size);
+  if (!surface->uniform_data)
+    return false;
+
+  glGenBuffers(1, &surface->ubo);
+  glBindBuffer(GL_UNIFORM_BUFFER, surface->ubo);
+  glBufferData(GL_UNIFORM_BUFFER, surface->uniform_size, NULL,
+               GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  return true;
 }
 
-void set_uniforms(shader_buffer *buf, struct timespec start_time,
-                  iMouse *mouse) {
-  double elapsed_time = time_elapsed(start_time);
+void free_uniform_buffer(shader_surface *surface) {
+  if (surface->ubo)
+    glDeleteBuffers(1, &surface->ubo);
+  surface->ubo = 0;
+  free(surface->uniform_data);
+  surface->uniform_data = NULL;
+}
+
+static void set_vec3(float *dst, float x, float y, float z) {
+  dst[0] = x;
+  dst[1] = y;
+  dst[2] = z;
+}
+
+static void fill_pass_uniforms(pass_uniforms *u, shader_surface *surface,
+                               render_pass *pass, iMouse *mouse) {
+  shader_buffer *buf = pass->buf;
+  shader_target *target = &surface->targets[buf->index];
+
+  memset(u, 0, sizeof(*u));
+  set_vec3(u->resolution, (float)target->width, (float)target->height,
+           (float)target->width / target->height);
 
-  // Calculate delta time and fps
-  double delta = (buf->frame == 0) ? 0 : (elapsed_time - buf->last_time);
-  float fps = (delta > 0) ? (1.0f / delta) : 0;
-
-  if (buf->u->resolution >= 0)
-    glUniform3f(buf->u->resolution, (float)buf->width, (float)buf->height,
-                (float)buf->width / buf->height);
-  if (buf->u->time >= 0)
-    glUniform1f(buf->u->time, (float)elapsed_time);
-  if (buf->u->time_delta >= 0)
-    glUniform1f(buf->u->time_delta, (float)delta);
   if (mouse) {
-    if (buf->u->mouse >= 0)
-      glUniform4f(buf->u->mouse, mouse->x, mouse->y, mouse->z, mouse->w);
-    if (buf->u->mouse_pos >= 0)
-      glUniform2f(buf->u->mouse_pos, mouse->real_x, mouse->real_y);
-  }
-  if (buf->u->frame >= 0)
-    glUniform1i(buf->u->frame, buf->frame);
-  if (buf->u->frame_rate >= 0)
-    glUniform1f(buf->u->frame_rate, fps);
-  if (buf->u->date >= 0) {
-    // Get current date/time
-    time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
-    float seconds = tm->tm_sec + tm->tm_min * 60 + tm->tm_hour * 3600;
-    glUniform4f(buf->u->date, (float)(tm->tm_year + 1900), (float)tm->tm_mon,
-                (float)tm->tm_mday, seconds);
+    // Mouse is in output pixels, map it to this buffer's resolution
+    float sx = (float)target->width / surface->width;
+    float sy = (float)target->height / surface->height;
+    u->mouse[0] = mouse->x * sx;
+    u->mouse[1] = mouse->y * sy;
+    u->mouse[2] = mouse->z * sx;
+    u->mouse[3] = mouse->w * sy;
+    u->mouse_pos[0] = mouse->real_x * sx;
+    u->mouse_pos[1] = mouse->real_y * sy;
   }
 
   for (int i = 0; i < 10; ++i) {
     if (!buf->channel[i])
       continue;
 
-    if (buf->u->channel_res[i] >= 0) {
-      switch (buf->channel[i]->type) {
-      case BUFFER:
-        glUniform3f(buf->u->channel_res[i], (float)buf->channel[i]->buf->width,
-                    (float)buf->channel[i]->buf->height,
-                    (float)buf->channel[i]->buf->width /
-                        buf->channel[i]->buf->height);
-        break;
-      case TEXTURE:
-        glUniform3f(buf->u->channel_res[i], (float)buf->channel[i]->tex->width,
-                    (float)buf->channel[i]->tex->height,
-                    (float)buf->channel[i]->tex->width /
-                        buf->channel[i]->tex->height);
-        break;
-      case VIDEO:
-        glUniform3f(buf->u->channel_res[i], (float)buf->channel[i]->vid->width,
-                    (float)buf->channel[i]->vid->height,
-                    (float)buf->channel[i]->vid->width /
-                        buf->channel[i]->vid->height);
-        break;
-      case AUDIO:
-        glUniform3f(buf->u->channel_res[i], (float)AUDIO_TEXTURE_WIDTH,
-                    (float)AUDIO_TEXTURE_HEIGHT,
-                    (float)AUDIO_TEXTURE_WIDTH / AUDIO_TEXTURE_HEIGHT);
-      default:
-        break;
-      }
+    float *res = u->channel_resolution[i];
+    switch (buf->channel[i]->type) {
+    case BUFFER: {
+      shader_target *other = &surface->targets[pass->source[i]];
+      set_vec3(res, (float)other->width, (float)other->height,
+               (float)other->width / other->height);
+      break;
     }
-
-    if (buf->u->channel_dur[i] >= 0) {
-      switch (buf->channel[i]->type) {
-      case BUFFER:
-      case TEXTURE:
-        glUniform1f(buf->u->channel_dur[i], 0);
-        break;
-      case VIDEO:
-        glUniform1f(buf->u->channel_dur[i], buf->channel[i]->vid->duration);
-        break;
-      case AUDIO:
-        glUniform1f(buf->u->channel_dur[i], buf->channel[i]->aud->duration);
-        break;
-      default:
-        break;
-      }
+    case TEXTURE:
+      set_vec3(res, (float)buf->channel[i]->tex->width,
+               (float)buf->channel[i]->tex->height,
+               (float)buf->channel[i]->tex->width /
+                   buf->channel[i]->tex->height);
+      break;
+    case VIDEO:
+      set_vec3(res, (float)buf->channel[i]->vid->width,
+               (float)buf->channel[i]->vid->height,
+               (float)buf->channel[i]->vid->width /
+                   buf->channel[i]->vid->height);
+      u->channel_duration[i][0] = buf->channel[i]->vid->duration;
+      break;
+    case AUDIO: {
+      shader_audio *aud = buf->channel[i]->aud;
+      set_vec3(res, (float)AUDIO_TEXTURE_WIDTH, (float)aud->texture_height,
+               (float)AUDIO_TEXTURE_WIDTH / aud->texture_height);
+      u->channel_duration[i][0] = aud->duration;
+      u->channel_history_row[i][0] = (float)aud->history_row;
+      break;
+    }
+    default:
+      break;
     }
   }
 }
+
+// Capture the frame globals once, so all passes of a frame see the same clock.
+// The frame block is uploaded every frame; pass blocks only when their
+// contents changed, which for most pipelines is only on resize.
+void update_uniform_buffer(shader_surface *surface, double elapsed_time,
+                           iMouse *mouse) {
+  frame_uniforms *frame = (frame_uniforms *)surface->uniform_data;
+
+  // Calculate delta time and fps
+  double delta =
+      (surface->frame == 0) ? 0 : (elapsed_time - surface->last_time);
+  frame->time = (float)elapsed_time;
+  frame->time_delta = (float)delta;
+  frame->frame_rate = (delta > 0) ? (1.0f / delta) : 0;
+  frame->frame = surface->frame;
+
+  // Get current date/time. A fixed clock starts at midnight, 2000-01-01, so
+  // runs don't depend on when they happen.
+  if (clock_is_fixed()) {
+    frame->date[0] = 2000;
+    frame->date[1] = 0;
+    frame->date[2] = 1;
+    frame->date[3] = (float)fmod(elapsed_time, 86400);
+  } else {
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    frame->date[0] = (float)(tm.tm_year + 1900);
+    frame->date[1] = (float)tm.tm_mon;
+    frame->date[2] = (float)tm.tm_mday;
+    frame->date[3] = tm.tm_sec + tm.tm_min * 60 + tm.tm_hour * 3600;
+  }
+
+  glBindBuffer(GL_UNIFORM_BUFFER, surface->ubo);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms), frame);
+  gl_count_call();
+
+  render_graph *graph = surface->ctx->graph;
+  for (int i = 0; i < graph->pass_count; i++) {
+    pass_uniforms u;
+    fill_pass_uniforms(&u, surface, &graph->passes[i], mouse);
+
+    unsigned char *shadow = surface->uniform_data + pass_offset(surface, i);
+    if (surface->frame > 0 && memcmp(shadow, &u, sizeof(u)) == 0)
+      continue;
+    memcpy(shadow, &u, sizeof(u));
+    glBufferSubData(GL_UNIFORM_BUFFER, pass_offset(surface, i), sizeof(u),
+                    &u);
+    gl_count_call();
+  }
+
+  gl_bind_uniform_range(FRAME_UNIFORM_BINDING, surface->ubo, 0,
+                        sizeof(frame_uniforms));
+}
+
+void bind_pass_uniforms(shader_surface *surface, render_pass *pass) {
+  gl_bind_uniform_range(PASS_UNIFORM_BINDING, surface->ubo,
+                        pass_offset(surface, pass->buf->index),
+                        sizeof(pass_uniforms));
+}
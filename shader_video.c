@@ -8,6 +8,9 @@
 #include <string.h>
 #include <sys/time.h>
 
+// Longest a fixed-clock step waits on mpv before rendering what it has
+#define VIDEO_STEP_TIMEOUT_NS 5000000000LL
+
 static void *get_proc_address_mpv(void *ctx, const char *name) {
   (void)ctx;
   return eglGetProcAddress(name);
@@ -125,10 +128,98 @@ shader_video *shader_video_create(char *path) {
   return vid;
 }
 
+static void handle_event(shader_video *vid, mpv_event *event) {
+  switch (event->event_id) {
+  case MPV_EVENT_VIDEO_RECONFIG: {
+    int64_t width, height;
+    if (mpv_get_property(vid->mpv, "video-params/w", MPV_FORMAT_INT64,
+                         &width) >= 0 &&
+        mpv_get_property(vid->mpv, "video-params/h", MPV_FORMAT_INT64,
+                         &height) >= 0) {
+
+      int new_width = (int)width;
+      int new_height = (int)height;
+
+      // Only update texture if size actually changed
+      if (new_width != vid->width || new_height != vid->height) {
+        vid->width = new_width;
+        vid->height = new_height;
+
+        // Update texture size
+        glBindTexture(GL_TEXTURE_2D, vid->tex_id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, vid->width, vid->height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        vid->fbo_configured = false; // Mark for reconfiguration
+      }
+    }
+    break;
+  }
+  case MPV_EVENT_SEEK:
+    vid->seeking = false;
+    break;
+  case MPV_EVENT_FILE_LOADED: {
+    // Get duration when file is loaded
+    double duration;
+    if (mpv_get_property(vid->mpv, "duration", MPV_FORMAT_DOUBLE,
+                         &duration) >= 0) {
+      vid->duration = duration;
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Fixed clock: keep mpv paused and seek it to the exact frame due at the
+// current time, so each run samples the same frames however fast it renders
+static void step_video(shader_video *vid, struct timespec start_time) {
+  int64_t deadline = current_time_in_ns() + VIDEO_STEP_TIMEOUT_NS;
+  if (vid->playing) {
+    int pause = 1;
+    mpv_set_property(vid->mpv, "pause", MPV_FORMAT_FLAG, &pause);
+    vid->playing = false;
+  }
+
+  // The first step also waits for the file to load and the texture to exist
+  while ((vid->duration <= 0 || vid->width == 0) &&
+         current_time_in_ns() < deadline)
+    handle_event(vid, mpv_wait_event(vid->mpv, 0.05));
+  if (vid->duration <= 0)
+    return;
+
+  double target_time = fmod(time_elapsed(start_time), vid->duration);
+  if (vid->stepped && target_time == vid->step_time)
+    return;
+
+  char time_str[32];
+  snprintf(time_str, sizeof(time_str), "%f", target_time);
+  const char *seek_cmd[] = {"seek", time_str, "absolute+exact", NULL};
+  if (mpv_command(vid->mpv, seek_cmd) < 0)
+    return;
+  vid->stepped = true;
+  vid->step_time = target_time;
+
+  // The seek is done once playback restarts at the new position
+  bool restarted = false;
+  while (!restarted && current_time_in_ns() < deadline) {
+    mpv_event *event = mpv_wait_event(vid->mpv, 0.05);
+    restarted = event->event_id == MPV_EVENT_PLAYBACK_RESTART;
+    handle_event(vid, event);
+  }
+  vid->frame_pending = restarted;
+}
+
 void shader_video_update(shader_video *vid, struct timespec start_time) {
   if (!vid || !vid->mpv)
     return;
 
+  if (clock_is_fixed()) {
+    step_video(vid, start_time);
+    return;
+  }
+
   // Process mpv events (but limit to avoid blocking)
   int event_count = 0;
   mpv_event *event;
@@ -138,47 +229,7 @@ void shader_video_update(shader_video *vid, struct timespec start_time) {
 
     event_count++;
 
-    switch (event->event_id) {
-    case MPV_EVENT_VIDEO_RECONFIG: {
-      int64_t width, height;
-      if (mpv_get_property(vid->mpv, "video-params/w", MPV_FORMAT_INT64,
-                           &width) >= 0 &&
-          mpv_get_property(vid->mpv, "video-params/h", MPV_FORMAT_INT64,
-                           &height) >= 0) {
-
-        int new_width = (int)width;
-        int new_height = (int)height;
-
-        // Only update texture if size actually changed
-        if (new_width != vid->width || new_height != vid->height) {
-          vid->width = new_width;
-          vid->height = new_height;
-
-          // Update texture size
-          glBindTexture(GL_TEXTURE_2D, vid->tex_id);
-          glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, vid->width, vid->height, 0,
-                       GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-          vid->fbo_configured = false; // Mark for reconfiguration
-        }
-      }
-      break;
-    }
-    case MPV_EVENT_SEEK:
-      vid->seeking = false;
-      break;
-    case MPV_EVENT_FILE_LOADED: {
-      // Get duration when file is loaded
-      double duration;
-      if (mpv_get_property(vid->mpv, "duration", MPV_FORMAT_DOUBLE,
-                           &duration) >= 0) {
-        vid->duration = duration;
-      }
-      break;
-    }
-    default:
-      break;
-    }
+    handle_event(vid, event);
   }
 
   // Check if we can seek and enough time has passed since last seek
@@ -268,8 +319,17 @@ void shader_video_render(shader_video *vid) {
       {MPV_RENDER_PARAM_INVALID, NULL},
   };
 
-  // Check if we need to render a new frame
+  // Check if we need to render a new frame. After a stepped seek, wait for
+  // its frame instead of keeping the previous one.
   uint64_t flags = mpv_render_context_update(vid->mpv_gl);
+  int64_t deadline = current_time_in_ns() + VIDEO_STEP_TIMEOUT_NS;
+  while (vid->frame_pending && !(flags & MPV_RENDER_UPDATE_FRAME) &&
+         current_time_in_ns() < deadline) {
+    struct timespec pause = {.tv_nsec = 1000000};
+    nanosleep(&pause, NULL);
+    flags = mpv_render_context_update(vid->mpv_gl);
+  }
+  vid->frame_pending = false;
   if (flags & MPV_RENDER_UPDATE_FRAME) {
     mpv_render_context_render(vid->mpv_gl, params);
   }
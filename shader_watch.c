@@ -0,0 +1,123 @@
+#include "shader_watch.h"
+#include "render_graph.h"
+#include "shader_buffer.h"
+#include <errno.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+// In-place saves finish with a close, atomic saves with a rename. Creation is
+// not watched since the file is still empty at that point.
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+static bool add_entry(shader_watch *watch, const char *path,
+                      shader_buffer *buf) {
+  char *dir_copy = strdup(path);
+  char *name_copy = strdup(path);
+  if (!dir_copy || !name_copy) {
+    free(dir_copy);
+    free(name_copy);
+    return false;
+  }
+
+  int wd = inotify_add_watch(watch->fd, dirname(dir_copy), WATCH_MASK);
+  char *name = strdup(basename(name_copy));
+  free(dir_copy);
+  free(name_copy);
+  if (wd < 0 || !name) {
+    if (wd < 0)
+      fprintf(stderr, "Warning: Could not watch '%s' for changes\n", path);
+    free(name);
+    return false;
+  }
+
+  shader_watch_entry *entries = realloc(
+      watch->entries, (watch->entry_count + 1) * sizeof(shader_watch_entry));
+  if (!entries) {
+    free(name);
+    return false;
+  }
+  watch->entries = entries;
+  watch->entries[watch->entry_count++] =
+      (shader_watch_entry){.wd = wd, .name = name, .buf = buf};
+  return true;
+}
+
+shader_watch *shader_watch_create(render_graph *graph,
+                                  const char *shared_shader_path) {
+  shader_watch *watch = calloc(1, sizeof(shader_watch));
+  if (!watch)
+    return NULL;
+
+  watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch->fd < 0) {
+    perror("inotify_init1 failed");
+    free(watch);
+    return NULL;
+  }
+
+  for (int i = 0; i < graph->pass_count; i++) {
+    shader_buffer *buf = graph->passes[i].buf;
+    if (buf->shader_path)
+      add_entry(watch, buf->shader_path, buf);
+  }
+  if (shared_shader_path)
+    add_entry(watch, shared_shader_path, NULL);
+
+  return watch;
+}
+
+// Drains pending events, flagging changed[i] for every pass whose program has
+// to be rebuilt. Returns whether any was flagged.
+bool shader_watch_read(shader_watch *watch, bool *changed, int pass_count) {
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool any = false;
+
+  while (true) {
+    ssize_t len = read(watch->fd, events, sizeof(events));
+    if (len <= 0) {
+      if (len < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (char *ptr = events; ptr < events + len;) {
+      const struct inotify_event *event = (const struct inotify_event *)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+      if (event->len == 0)
+        continue;
+
+      for (int i = 0; i < watch->entry_count; i++) {
+        shader_watch_entry *entry = &watch->entries[i];
+        if (entry->wd != event->wd || strcmp(entry->name, event->name) != 0)
+          continue;
+
+        if (entry->buf) {
+          changed[entry->buf->index] = true;
+        } else {
+          for (int j = 0; j < pass_count; j++)
+            changed[j] = true;
+        }
+        any = true;
+      }
+    }
+  }
+
+  return any;
+}
+
+void shader_watch_free(shader_watch *watch) {
+  if (!watch)
+    return;
+
+  for (int i = 0; i < watch->entry_count; i++)
+    free(watch->entries[i].name);
+  free(watch->entries);
+  if (watch->fd >= 0)
+    close(watch->fd);
+  free(watch);
+}
@@ -1,6 +1,9 @@
 #include "util.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <time.h>
 
 char *load_file(const char *path) {
@@ -28,7 +31,22 @@ double timespec_to_sec(struct timespec ts) {
   return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
+// Set when the shader clock is driven by set_fixed_time instead of
+// CLOCK_MONOTONIC
+static bool clock_fixed = false;
+static struct timespec fixed_time;
+
+void set_fixed_time(struct timespec time) {
+  clock_fixed = true;
+  fixed_time = time;
+}
+
+bool clock_is_fixed() { return clock_fixed; }
+
 struct timespec current_time() {
+  if (clock_fixed)
+    return fixed_time;
+
   struct timespec now;
   clock_gettime(CLOCK_MONOTONIC, &now);
   return now;
@@ -39,3 +57,75 @@ double current_time_in_sec() { return timespec_to_sec(current_time()); }
 double time_elapsed(struct timespec start_time) {
   return current_time_in_sec() - timespec_to_sec(start_time);
 }
+
+int64_t timespec_to_ns(struct timespec ts) {
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct timespec ns_to_timespec(int64_t ns) {
+  struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+  return ts;
+}
+
+int64_t current_time_in_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return timespec_to_ns(now);
+}
+
+// Create every missing component of path, like `mkdir -p`
+static bool make_directories(char *path) {
+  for (char *p = path + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+    *p = '/';
+    if (!ok)
+      return false;
+  }
+  return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+char *cache_dir() {
+  const char *xdg_cache = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  const char *suffix;
+  const char *base;
+  if (xdg_cache && xdg_cache[0] == '/') {
+    base = xdg_cache;
+    suffix = "/wlsbg";
+  } else if (home && home[0] == '/') {
+    base = home;
+    suffix = "/.cache/wlsbg";
+  } else {
+    return NULL;
+  }
+
+  size_t size = strlen(base) + strlen(suffix) + 1;
+  char *path = malloc(size);
+  if (!path)
+    return NULL;
+  snprintf(path, size, "%s%s", base, suffix);
+
+  if (!make_directories(path)) {
+    free(path);
+    return NULL;
+  }
+  return path;
+}
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+  // FNV-1a
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+uint64_t hash_string(uint64_t hash, const char *str) {
+  // Include the terminator so consecutive strings can't run together
+  return hash_bytes(hash, str ? str : "", strlen(str ? str : "") + 1);
+}